@@ -0,0 +1,141 @@
+#ifndef CLP_BENCH_H
+#define CLP_BENCH_H
+
+// Timing helpers shared by the programs in bench/. Each measurement is
+// printed as one JSON object per line on stdout so runs can be collected
+// and compared by scripts, e.g. to catch regressions on CI hosts.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace bench
+{
+
+typedef std::chrono::steady_clock Clock;
+
+inline double seconds(Clock::time_point start)
+{
+	return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// all times in seconds
+struct Stats {
+	size_t samples;
+	double min, median, p99, mean;
+};
+
+inline Stats summarize(std::vector<double> samples)
+{
+	Stats s = Stats();
+	s.samples = samples.size();
+	if(samples.empty())
+		return s;
+	std::sort(samples.begin(), samples.end());
+	s.min = samples.front();
+	s.median = samples[samples.size()/2];
+	s.p99 = samples[std::min(samples.size() - 1, size_t(std::ceil(samples.size()*0.99)) - 1)];
+	double sum = 0;
+	for(size_t i = 0;i<samples.size();++i)
+		sum += samples[i];
+	s.mean = sum/samples.size();
+	return s;
+}
+
+// Times count calls of f after warmup untimed ones. f has to finish its
+// device work before returning, typically by waiting on an event.
+template<class F>
+Stats measure(F f, size_t count, size_t warmup = 2)
+{
+	for(size_t i = 0;i<warmup;++i)
+		f();
+	std::vector<double> samples(count);
+	for(size_t i = 0;i<count;++i)
+	{
+		Clock::time_point start = Clock::now();
+		f();
+		samples[i] = seconds(start);
+	}
+	return summarize(samples);
+}
+
+// Extra key/value pairs of a result line, e.g. the transfer size.
+class Fields {
+public:
+	Fields& operator()(const std::string &key, double value)
+	{
+		std::ostringstream s;
+		s.precision(10);
+		s << value;
+		fields.push_back(std::make_pair(key, s.str()));
+		return *this;
+	}
+
+	Fields& operator()(const std::string &key, const std::string &value)
+	{
+		fields.push_back(std::make_pair(key, "\"" + escape(value) + "\""));
+		return *this;
+	}
+
+	std::string json() const
+	{
+		std::string result;
+		for(size_t i = 0;i<fields.size();++i)
+			result += ", \"" + escape(fields[i].first) + "\": " + fields[i].second;
+		return result;
+	}
+
+	static std::string escape(const std::string &s)
+	{
+		std::string result;
+		for(size_t i = 0;i<s.size();++i)
+		{
+			if(s[i] == '"' || s[i] == '\\')
+				result += '\\';
+			if(static_cast<unsigned char>(s[i]) >= 0x20)
+				result += s[i];
+		}
+		return result;
+	}
+private:
+	std::vector<std::pair<std::string, std::string> > fields;
+};
+
+// Prints one result line. With bytes set the median bandwidth is added in
+// GB/s, with flops the median rate in GFLOP/s.
+inline void report(const std::string &name, const Stats &s, const Fields &fields = Fields(), double bytes = 0, double flops = 0)
+{
+	std::ostringstream out;
+	out.precision(6);
+	out << "{\"benchmark\": \"" << Fields::escape(name) << "\"" << fields.json()
+		<< ", \"samples\": " << s.samples
+		<< ", \"min_us\": " << s.min*1e6
+		<< ", \"median_us\": " << s.median*1e6
+		<< ", \"p99_us\": " << s.p99*1e6
+		<< ", \"mean_us\": " << s.mean*1e6;
+	if(bytes > 0 && s.median > 0)
+		out << ", \"gbps\": " << bytes/s.median*1e-9;
+	if(flops > 0 && s.median > 0)
+		out << ", \"gflops\": " << flops/s.median*1e-9;
+	out << "}";
+	std::cout << out.str() << std::endl;
+}
+
+// --quick shrinks sample counts and sizes for smoke runs
+inline bool quick(int argc, char *argv[])
+{
+	for(int i = 1;i<argc;++i)
+		if(std::strcmp(argv[i], "--quick") == 0)
+			return true;
+	return false;
+}
+
+}
+
+#endif
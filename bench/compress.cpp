@@ -0,0 +1,102 @@
+// Effective bandwidth of compressed transfers (Compressor) against plain
+// buffer writes and reads, for data of increasing bit width per block and
+// for delta coded timestamps. Meant to run on a CPU device (e.g. pocl),
+// see README.md for building.
+//
+//   compress [--quick]
+
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "../include/CLCompress.h"
+#include "Bench.h"
+
+namespace {
+
+// values around an offset that vary in their low bits only
+std::vector<cl_int> narrow(size_t n, int bits)
+{
+	std::vector<cl_int> v(n);
+	const cl_uint mask = bits >= 32 ? 0xffffffffu : (1u << bits) - 1;
+	for(size_t i = 0;i<n;++i)
+		v[i] = cl_int(100000 + ((cl_uint(std::rand()) << 16 ^ cl_uint(std::rand())) & mask));
+	return v;
+}
+
+// increasing timestamps with jittered steps, as in telemetry
+std::vector<cl_int> timestamps(size_t n)
+{
+	std::vector<cl_int> v(n);
+	cl_int t = 0;
+	for(size_t i = 0;i<n;++i)
+	{
+		t += 1000 + std::rand()%64;
+		v[i] = t;
+	}
+	return v;
+}
+
+bool verify(const std::vector<cl_int> &a, const std::vector<cl_int> &b)
+{
+	if(a == b)
+		return true;
+	std::cerr << "compressed transfer mismatch" << std::endl;
+	return false;
+}
+
+bool benchData(clp::Context &context, const std::vector<cl_int> &data, bool delta, const bench::Fields &fields, size_t samples)
+{
+	const size_t n = data.size();
+	const double bytes = double(n*sizeof(cl_int));
+	clp::Buffer<cl_int> buffer(context, n);
+	clp::Compressor<cl_int> compressor(context, delta);
+	std::vector<cl_int> result(n);
+
+	compressor.write(buffer, data.data()).wait();
+	compressor.read(buffer, result.data());
+	if(!verify(data, result))
+		return false;
+	const bench::Fields f = bench::Fields(fields)("ratio", compressor.getLastRatio());
+
+	bench::report("write_plain", bench::measure([&]() {
+		buffer.write(data.data()).wait();
+	}, samples), f, bytes);
+	bench::report("write_compressed", bench::measure([&]() {
+		compressor.write(buffer, data.data()).wait();
+	}, samples), f, bytes);
+	bench::report("read_plain", bench::measure([&]() {
+		buffer.read(result.data()).wait();
+	}, samples), f, bytes);
+	bench::report("read_compressed", bench::measure([&]() {
+		compressor.read(buffer, result.data());
+	}, samples), f, bytes);
+	return true;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+	try
+	{
+		const bool quick = bench::quick(argc, argv);
+		clp::Context context(CL_DEVICE_TYPE_CPU);
+		const size_t n = quick ? (size_t(1) << 18) : (size_t(1) << 24);
+		const size_t samples = quick ? 5 : 20;
+		const bench::Fields fields = bench::Fields()("device", context.getDeviceInfo().name)("elements", double(n));
+
+		const int widths[] = {1, 4, 8, 12, 16, 24, 32};
+		for(size_t i = 0;i<sizeof(widths)/sizeof(widths[0]);++i)
+			if(!benchData(context, narrow(n, widths[i]), false, bench::Fields(fields)("data", "narrow")("bits", widths[i]), samples))
+				return 1;
+		if(!benchData(context, timestamps(n), true, bench::Fields(fields)("data", "timestamps"), samples))
+			return 1;
+	}
+	catch(const std::exception &e)
+	{
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,130 @@
+// GEMM, batched GEMM and GEMV against a plain host loop on the same CPU.
+// Meant to run on a CPU device (e.g. pocl), see README.md for building.
+//
+//   gemm [--quick]
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "../include/CLBlas.h"
+#include "Bench.h"
+
+namespace {
+
+// reference C = A*B for count matrices stored back to back
+void hostGemm(size_t count, size_t M, size_t N, size_t K, const std::vector<float> &A, const std::vector<float> &B, std::vector<float> &C)
+{
+	std::fill(C.begin(), C.end(), 0.0f);
+	for(size_t b = 0;b<count;++b)
+	{
+		const float *a = &A[b*M*K];
+		const float *bb = &B[b*K*N];
+		float *c = &C[b*M*N];
+		for(size_t i = 0;i<M;++i)
+			for(size_t k = 0;k<K;++k)
+			{
+				const float v = a[i*K + k];
+				for(size_t j = 0;j<N;++j)
+					c[i*N + j] += v*bb[k*N + j];
+			}
+	}
+}
+
+void hostGemv(size_t M, size_t N, const std::vector<float> &A, const std::vector<float> &x, std::vector<float> &y)
+{
+	for(size_t i = 0;i<M;++i)
+	{
+		float acc = 0;
+		for(size_t j = 0;j<N;++j)
+			acc += A[i*N + j]*x[j];
+		y[i] = acc;
+	}
+}
+
+std::vector<float> random(size_t n)
+{
+	std::vector<float> v(n);
+	for(size_t i = 0;i<n;++i)
+		v[i] = float(std::rand())/RAND_MAX - 0.5f;
+	return v;
+}
+
+float maxError(const std::vector<float> &a, const std::vector<float> &b)
+{
+	float error = 0;
+	for(size_t i = 0;i<a.size();++i)
+		error = std::max(error, std::fabs(a[i] - b[i]));
+	return error;
+}
+
+void benchGemm(clp::Context &context, clp::Blas<cl_float> &blas, size_t count, size_t M, size_t N, size_t K, int repeat)
+{
+	std::vector<float> A = random(count*M*K), B = random(count*K*N), C(count*M*N), reference(count*M*N);
+	clp::Buffer<float> a(context, A.size()), b(context, B.size()), c(context, C.size());
+	a.write(A.data()).wait();
+	b.write(B.data()).wait();
+
+	const bench::Stats device = bench::measure([&]() {
+		if(count == 1)
+			blas.gemm(cl_uint(M), cl_uint(N), cl_uint(K), 1.0f, a, b, 0.0f, c).wait();
+		else
+			blas.gemmBatched(cl_uint(count), cl_uint(M), cl_uint(N), cl_uint(K), 1.0f, a, b, 0.0f, c).wait();
+	}, repeat, 1);
+	c.read(C.data()).wait();
+	const bench::Stats host = bench::measure([&]() { hostGemm(count, M, N, K, A, B, reference); }, repeat, 0);
+
+	const double flops = 2.0*count*M*N*K;
+	const bench::Fields fields = bench::Fields()("count", double(count))("M", double(M))("N", double(N))("K", double(K));
+	bench::report(count == 1 ? "gemm" : "gemm_batched", device, bench::Fields(fields)("max_error", maxError(C, reference)), 0, flops);
+	bench::report(count == 1 ? "gemm_host" : "gemm_batched_host", host, fields, 0, flops);
+}
+
+void benchGemv(clp::Context &context, clp::Blas<cl_float> &blas, size_t M, size_t N, int repeat)
+{
+	std::vector<float> A = random(M*N), x = random(N), y(M), reference(M);
+	clp::Buffer<float> a(context, A.size()), bx(context, N), by(context, M);
+	a.write(A.data()).wait();
+	bx.write(x.data()).wait();
+
+	const bench::Stats device = bench::measure([&]() { blas.gemv(cl_uint(M), cl_uint(N), 1.0f, a, bx, 0.0f, by).wait(); }, repeat, 1);
+	by.read(y.data()).wait();
+	const bench::Stats host = bench::measure([&]() { hostGemv(M, N, A, x, reference); }, repeat, 0);
+
+	const bench::Fields fields = bench::Fields()("M", double(M))("N", double(N));
+	bench::report("gemv", device, bench::Fields(fields)("max_error", maxError(y, reference)), 0, 2.0*M*N);
+	bench::report("gemv_host", host, fields, 0, 2.0*M*N);
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+	try
+	{
+		clp::Context context(CL_DEVICE_TYPE_CPU);
+		clp::Blas<cl_float> blas(context);
+		std::cerr << "tile " << blas.getTileSize() << ", blocking " << blas.getBlocking()
+			<< ", vector width " << blas.getVectorWidth() << std::endl;
+
+		const bool quick = bench::quick(argc, argv);
+		benchGemm(context, blas, 1, 256, 256, 256, 10);
+		if(!quick)
+		{
+			benchGemm(context, blas, 1, 1024, 1024, 1024, 3);
+			benchGemm(context, blas, 1, 1000, 1000, 1000, 3);
+		}
+		benchGemm(context, blas, quick ? 1024 : 16384, 8, 8, 8, 10);
+		benchGemm(context, blas, quick ? 256 : 4096, 16, 16, 16, 10);
+		benchGemm(context, blas, quick ? 64 : 1024, 32, 32, 32, 10);
+		benchGemv(context, blas, quick ? 1024 : 4096, quick ? 1024 : 4096, 10);
+	}
+	catch(const std::exception &e)
+	{
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
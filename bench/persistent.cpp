@@ -0,0 +1,118 @@
+// Request latency of a persistent kernel polling a WorkQueue against one
+// kernel launch per request. Meant to run on a CPU device with fine
+// grained SVM atomics (e.g. pocl), see README.md for building.
+//
+//   persistent [--quick]
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include "../include/CLWorkQueue.h"
+#include "Bench.h"
+
+namespace {
+
+// a small request: reduce a handful of values
+struct Request {
+	cl_float values[16];
+	cl_float sum;
+};
+
+const char *request_source =
+	"typedef struct { float values[16]; float sum; } request;\n"
+	"void handle(global request *r)\n"
+	"{\n"
+	"	float sum = 0;\n"
+	"	for(int i = 0;i<16;++i)\n"
+	"		sum += r->values[i];\n"
+	"	r->sum = sum;\n"
+	"}\n"
+	"kernel void launch(global request *r)\n"
+	"{\n"
+	"	handle(r);\n"
+	"}\n";
+
+Request makeRequest(size_t n)
+{
+	Request r;
+	for(size_t i = 0;i<16;++i)
+		r.values[i] = cl_float(n + i);
+	r.sum = 0;
+	return r;
+}
+
+// the way such a request is served without a persistent kernel: upload,
+// launch and read back, waiting for each step
+void benchLaunch(clp::Context &context, const bench::Fields &fields, size_t samples)
+{
+	clp::Program program(context);
+	program.setSource(request_source);
+	program.build();
+	clp::Kernel<void(Request*)> launch = program.getKernel<void(Request*)>("launch");
+	clp::Buffer<Request> buffer(context, 1);
+	const clp::Worksize ws(1, 1);
+	size_t n = 0;
+	Request r;
+	bench::report("request_launch", bench::measure([&]() {
+		r = makeRequest(n++);
+		buffer.write(&r).wait();
+		launch(ws, buffer).wait();
+		buffer.read(&r).wait();
+	}, samples), fields);
+}
+
+void benchPersistent(clp::WorkQueue<Request> &queue, const bench::Fields &fields, size_t samples)
+{
+	size_t n = 0;
+	bench::report("request_persistent", bench::measure([&]() {
+		queue.wait(queue.submit(makeRequest(n++)));
+	}, samples), fields);
+
+	// requests in flight, per request cost
+	const size_t depth = queue.getCapacity()/2;
+	std::vector<cl_uint> tickets(depth);
+	bench::Stats s = bench::measure([&]() {
+		for(size_t i = 0;i<depth;++i)
+			tickets[i] = queue.submit(makeRequest(n++));
+		for(size_t i = 0;i<depth;++i)
+			queue.wait(tickets[i]);
+	}, samples/10 + 1);
+	s.min /= depth; s.median /= depth; s.p99 /= depth; s.mean /= depth;
+	bench::report("request_persistent_pipelined", s, bench::Fields(fields)("depth", double(depth)));
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+	try
+	{
+		const bool quick = bench::quick(argc, argv);
+		// the persistent kernel keeps its queue busy, launches use the other
+		clp::Context context(CL_DEVICE_TYPE_CPU, 0, 2);
+		const clp::DeviceInfo &info = context.getDeviceInfo();
+		if(!(info.svm_capabilities & CL_DEVICE_SVM_ATOMICS))
+		{
+			std::cerr << info.name << " has no fine grained SVM atomics, skipping" << std::endl;
+			return 0;
+		}
+		const size_t samples = quick ? 100 : 10000;
+		const bench::Fields fields = bench::Fields()("device", info.name);
+
+		benchLaunch(context, fields, samples);
+
+		// leave a compute unit to the submitting thread
+		const size_t workers = std::max<size_t>(info.compute_units, 2) - 1;
+		context.setCurrentQueue(1);
+		clp::WorkQueue<Request> queue(context, request_source, "request", "handle", 64, workers);
+		context.setCurrentQueue(0);
+		benchPersistent(queue, bench::Fields(fields)("workers", double(workers)), samples);
+	}
+	catch(const std::exception &e)
+	{
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,158 @@
+// Overhead and bandwidth of the clp primitives: kernel launches, buffer
+// transfers and mapping, image mapping, events and program builds. Meant
+// to run on a CPU device (e.g. pocl) so regressions in the wrapper show up
+// on plain CI hosts, see README.md for building.
+//
+//   primitives [--quick]
+
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include "../include/CLProgram.h"
+#include "../include/CLImage.h"
+#include "Bench.h"
+
+namespace {
+
+const char *nop_source =
+	"kernel void nop(global int *x)\n"
+	"{\n"
+	"}\n";
+
+void benchLaunch(clp::Context &context, const std::string &device, size_t samples)
+{
+	clp::Program program(context);
+	program.setSource(nop_source);
+	program.build();
+	clp::Kernel<void(int*)> nop = program.getKernel<void(int*)>("nop");
+	clp::Buffer<int> x(context, 1);
+	const clp::Worksize ws(1, 1);
+
+	// host cost of a single enqueue, drained outside of the timed region
+	std::vector<double> enqueue(samples);
+	for(size_t i = 0;i<samples;++i)
+	{
+		bench::Clock::time_point start = bench::Clock::now();
+		clp::Event event = nop(ws, x);
+		enqueue[i] = bench::seconds(start);
+		event.wait();
+	}
+	bench::report("launch_enqueue", bench::summarize(enqueue), bench::Fields()("device", device));
+
+	bench::report("launch_roundtrip", bench::measure([&]() { nop(ws, x).wait(); }, samples), bench::Fields()("device", device));
+
+	// back to back launches, per launch cost
+	const size_t batch = 100;
+	bench::Stats s = bench::measure([&]() {
+		clp::Event event;
+		for(size_t i = 0;i<batch;++i)
+			event = nop(ws, x);
+		event.wait();
+	}, samples/10 + 1);
+	s.min /= batch; s.median /= batch; s.p99 /= batch; s.mean /= batch;
+	bench::report("launch_batched", s, bench::Fields()("device", device)("batch", double(batch)));
+}
+
+void benchBuffer(clp::Context &context, const std::string &device, size_t samples, size_t max_size)
+{
+	for(size_t bytes = 4096;bytes<=max_size;bytes *= 8)
+	{
+		const size_t n = bytes/sizeof(float);
+		std::vector<float> host(n, 1.0f);
+		clp::Buffer<float> buffer(context, n);
+		const size_t count = bytes >= (size_t(16) << 20) ? samples/10 + 1 : samples;
+		const bench::Fields fields = bench::Fields()("device", device)("bytes", double(bytes));
+
+		bench::report("buffer_write", bench::measure([&]() { buffer.write(host.data()).wait(); }, count), fields, double(bytes));
+		bench::report("buffer_read", bench::measure([&]() { buffer.read(host.data()).wait(); }, count), fields, double(bytes));
+		bench::report("buffer_map_unmap", bench::measure([&]() {
+			buffer.map().wait();
+			buffer.unmap().wait();
+		}, count), fields);
+		bench::report("buffer_map_write_unmap", bench::measure([&]() {
+			buffer.map(CL_MAP_WRITE).wait();
+			std::fill(buffer.begin(), buffer.end(), 2.0f);
+			buffer.unmap().wait();
+		}, count), fields, double(bytes));
+	}
+}
+
+void benchImage(clp::Context &context, const std::string &device, size_t samples, size_t size)
+{
+	if(!context.getDeviceInfo().image_support)
+		return;
+	clp::Image2D<cl_float> image(context, size, size);
+	const bench::Fields fields = bench::Fields()("device", device)("width", double(size))("height", double(size));
+	bench::report("image2d_map_unmap", bench::measure([&]() {
+		image.map().wait();
+		image.unmap().wait();
+	}, samples), fields);
+	bench::report("image2d_map_write_unmap", bench::measure([&]() {
+		image.map(CL_MAP_WRITE).wait();
+		for(size_t y = 0;y<size;++y)
+			for(size_t x = 0;x<size;++x)
+				image(x, y) = 1.0f;
+		image.unmap().wait();
+	}, samples), fields, double(size*size*sizeof(cl_float)));
+}
+
+void benchEvents(clp::Context &context, const std::string &device, size_t samples)
+{
+	const bench::Fields fields = bench::Fields()("device", device);
+	bench::report("marker_wait", bench::measure([&]() {
+		cl_event e;
+		clp::checkError(clEnqueueMarkerWithWaitList(context.getQueue(), 0, 0, &e));
+		clp::Event(e).wait();
+	}, samples), fields);
+	bench::report("user_event_signal_wait", bench::measure([&]() {
+		cl_int error;
+		cl_event e = clCreateUserEvent(context.getContext(), &error);
+		clp::checkError(error);
+		clp::Event event(e);
+		clp::checkError(clSetUserEventStatus(e, CL_COMPLETE));
+		event.wait();
+	}, samples), fields);
+	cl_event e;
+	clp::checkError(clEnqueueMarkerWithWaitList(context.getQueue(), 0, 0, &e));
+	clp::Event completed(e);
+	completed.wait();
+	bench::report("event_status_query", bench::measure([&]() { completed.getStatus(); }, samples), fields);
+}
+
+void benchBuild(clp::Context &context, const std::string &device, size_t samples)
+{
+	// a distinct define per build keeps compiler caches such as pocl's out
+	size_t salt = 0;
+	bench::report("program_build", bench::measure([&]() {
+		std::ostringstream options;
+		options << "-DCLP_BENCH_SALT=" << salt++;
+		clp::Program program(context);
+		program.setSource(nop_source);
+		program.build(options.str());
+	}, samples, 1), bench::Fields()("device", device));
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+	try
+	{
+		const bool quick = bench::quick(argc, argv);
+		clp::Context context(CL_DEVICE_TYPE_CPU);
+		const std::string device = context.getDeviceInfo().name;
+
+		benchLaunch(context, device, quick ? 50 : 1000);
+		benchBuffer(context, device, quick ? 10 : 100, quick ? (size_t(1) << 20) : (size_t(64) << 20));
+		benchImage(context, device, quick ? 10 : 100, quick ? 256 : 2048);
+		benchEvents(context, device, quick ? 50 : 1000);
+		benchBuild(context, device, quick ? 3 : 20);
+	}
+	catch(const std::exception &e)
+	{
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
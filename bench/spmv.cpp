@@ -0,0 +1,156 @@
+// SpMV and SpMM on synthetic matrices with power law and uniform row
+// lengths, for every sparse format and both CSR strategies, against a
+// plain host loop. Meant to run on a CPU device (e.g. pocl), see README.md
+// for building.
+//
+//   spmv [--quick]
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../include/CLSparse.h"
+#include "Bench.h"
+
+namespace {
+
+double uniform()
+{
+	return (std::rand() + 1.0)/(RAND_MAX + 2.0);
+}
+
+// row lengths from a Pareto distribution with exponent 2, as in graphs
+// with a few hub vertices, or a fixed length
+clp::CooMatrix<float> matrix(cl_uint rows, cl_uint columns, bool power_law, cl_uint length)
+{
+	clp::CooMatrix<float> m(rows, columns);
+	m.reserve(size_t(rows)*length*2);
+	for(cl_uint r = 0;r<rows;++r)
+	{
+		const double l = power_law ? std::floor(length/2.0/std::sqrt(uniform())) : length;
+		const cl_uint n = cl_uint(std::min<double>(l, columns));
+		for(cl_uint i = 0;i<n;++i)
+			m.add(r, cl_uint(std::rand()) % columns, float(uniform()));
+	}
+	return m;
+}
+
+void hostSpmv(const clp::CooMatrix<float> &m, const std::vector<float> &x, std::vector<float> &y)
+{
+	std::fill(y.begin(), y.end(), 0.0f);
+	const std::vector<cl_uint> &row = m.getRowIndex();
+	const std::vector<cl_uint> &column = m.getColumnIndex();
+	const std::vector<float> &value = m.getValues();
+	for(size_t i = 0;i<value.size();++i)
+		y[row[i]] += value[i]*x[column[i]];
+}
+
+// Y = m*X for row major X with k columns
+void hostSpmm(const clp::CooMatrix<float> &m, cl_uint k, const std::vector<float> &X, std::vector<float> &Y)
+{
+	std::fill(Y.begin(), Y.end(), 0.0f);
+	const std::vector<cl_uint> &row = m.getRowIndex();
+	const std::vector<cl_uint> &column = m.getColumnIndex();
+	const std::vector<float> &value = m.getValues();
+	for(size_t i = 0;i<value.size();++i)
+		for(cl_uint j = 0;j<k;++j)
+			Y[size_t(row[i])*k + j] += value[i]*X[size_t(column[i])*k + j];
+}
+
+float maxError(const std::vector<float> &a, const std::vector<float> &b)
+{
+	float error = 0;
+	for(size_t i = 0;i<a.size();++i)
+		error = std::max(error, std::fabs(a[i] - b[i])/std::max(1.0f, std::fabs(b[i])));
+	return error;
+}
+
+template<class M>
+void benchFormat(clp::Sparse<float> &sparse, const std::string &name, const M &A, const bench::Fields &fields, size_t samples,
+	clp::Buffer<float> &x, clp::Buffer<float> &y, clp::Buffer<float> &X, clp::Buffer<float> &Y, cl_uint k,
+	const std::vector<float> &reference, const std::vector<float> &reference_mm)
+{
+	const double flops = 2.0*A.getNonzeros();
+	std::vector<float> result(A.getRows()), result_mm(size_t(A.getRows())*k);
+	sparse.spmv(A, x, y).wait();
+	y.read(result.data()).wait();
+	sparse.spmm(k, A, X, Y).wait();
+	Y.read(result_mm.data()).wait();
+	bench::report("spmv_" + name, bench::measure([&]() {
+		sparse.spmv(A, x, y).wait();
+	}, samples), bench::Fields(fields)("error", maxError(result, reference)), 0, flops);
+	bench::report("spmm_" + name, bench::measure([&]() {
+		sparse.spmm(k, A, X, Y).wait();
+	}, samples), bench::Fields(fields)("error", maxError(result_mm, reference_mm))("k", k), 0, flops*k);
+}
+
+void benchMatrix(clp::Context &context, clp::Sparse<float> &sparse, const clp::CooMatrix<float> &coo, const bench::Fields &fields, size_t samples)
+{
+	const cl_uint k = 8;
+	const cl_uint rows = coo.getRows(), columns = coo.getColumns();
+	std::vector<float> hx(columns), hX(size_t(columns)*k), reference(rows), reference_mm(size_t(rows)*k);
+	for(size_t i = 0;i<hx.size();++i)
+		hx[i] = float(uniform());
+	for(size_t i = 0;i<hX.size();++i)
+		hX[i] = float(uniform());
+	clp::Buffer<float> x(context, columns), y(context, rows), X(context, hX.size()), Y(context, size_t(rows)*k);
+	x.write(hx.data());
+	X.write(hX.data()).wait();
+
+	hostSpmv(coo, hx, reference);
+	hostSpmm(coo, k, hX, reference_mm);
+	clp::CsrMatrix<float> csr(context, coo);
+	const clp::RowStats &stats = csr.getRowStats();
+	const bench::Fields f = bench::Fields(fields)("nonzeros", double(csr.getNonzeros()))
+		("mean_row", stats.mean_length)("max_row", stats.max_length)("auto_lanes", double(csr.getLanes()));
+
+	std::vector<float> y_host(rows);
+	bench::report("spmv_host", bench::measure([&]() {
+		hostSpmv(coo, hx, y_host);
+	}, samples), f, 0, 2.0*csr.getNonzeros());
+
+	const size_t automatic = csr.getLanes();
+	benchFormat(sparse, "csr_auto", csr, f, samples, x, y, X, Y, k, reference, reference_mm);
+	csr.setLanes(1);
+	benchFormat(sparse, "csr_scalar", csr, f, samples, x, y, X, Y, k, reference, reference_mm);
+	csr.setLanes(std::max<size_t>(automatic, 8));
+	benchFormat(sparse, "csr_vector", csr, bench::Fields(f)("lanes", double(csr.getLanes())), samples, x, y, X, Y, k, reference, reference_mm);
+
+	// plain ELL pads every row to the longest one, skip it when that
+	// would multiply the storage
+	if(size_t(rows)*stats.max_length <= 4*csr.getNonzeros())
+	{
+		clp::EllMatrix<float> ell(context, coo);
+		benchFormat(sparse, "ell", ell, f, samples, x, y, X, Y, k, reference, reference_mm);
+	}
+	clp::SlicedEllMatrix<float> sell(context, coo);
+	benchFormat(sparse, "sliced_ell", sell, bench::Fields(f)("stored", double(sell.getStoredEntries())), samples, x, y, X, Y, k, reference, reference_mm);
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+	try
+	{
+		const bool quick = bench::quick(argc, argv);
+		clp::Context context(CL_DEVICE_TYPE_CPU);
+		clp::Sparse<float> sparse(context);
+		const cl_uint n = quick ? 1 << 12 : 1 << 18;
+		const size_t samples = quick ? 5 : 50;
+		const bench::Fields fields = bench::Fields()("device", context.getDeviceInfo().name)("rows", double(n));
+
+		std::srand(1);
+		benchMatrix(context, sparse, matrix(n, n, true, 8), bench::Fields(fields)("matrix", "power_law"), samples);
+		benchMatrix(context, sparse, matrix(n, n, false, 8), bench::Fields(fields)("matrix", "uniform"), samples);
+	}
+	catch(const std::exception &e)
+	{
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
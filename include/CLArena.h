@@ -0,0 +1,259 @@
+#ifndef CL_ARENA_H
+#define CL_ARENA_H
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <utility>
+
+#include "CLEvent.h"
+#include "CLContext.h"
+
+namespace clp {
+
+// A typed region of a StagingArena, valid as a kernel argument like a
+// Buffer<T> holding size() elements. Kernels can also take the arena's
+// buffer and getOffset() instead, which avoids the sub-buffer.
+template<class T>
+class Slice {
+public:
+	typedef T value_type;
+
+	Slice() : mem(0), host_ptr(0), count(0), offset(0) { }
+
+	Slice(cl_mem m, value_type *p, size_t n, size_t o)
+		: mem(m), host_ptr(p), count(n), offset(o)
+	{
+	}
+
+	Slice(const Slice &s)
+		: mem(s.mem), host_ptr(s.host_ptr), count(s.count), offset(s.offset)
+	{
+		if(mem)
+			clRetainMemObject(mem);
+	}
+
+	Slice& operator=(const Slice &s)
+	{
+		if(s.mem)
+			clRetainMemObject(s.mem);
+		if(mem)
+			clReleaseMemObject(mem);
+		mem = s.mem;
+		host_ptr = s.host_ptr;
+		count = s.count;
+		offset = s.offset;
+		return *this;
+	}
+
+	// staging memory, written by the host until the arena is flushed
+	value_type& operator[](size_t i) const { return host_ptr[i]; }
+	value_type* data() const { return host_ptr; }
+	size_t size() const { return count; }
+
+	// position in the arena's buffer, in elements of T
+	size_t getOffset() const { return offset/sizeof(value_type); }
+	size_t getByteOffset() const { return offset; }
+	const cl_mem* getMem() const { return &mem; }
+
+	~Slice()
+	{
+		if(mem)
+			clReleaseMemObject(mem);
+	}
+private:
+	cl_mem mem;
+	value_type *host_ptr;
+	size_t count;
+	size_t offset;
+};
+
+// Ring of small uploads such as per launch parameter blocks. Allocations
+// are carved from a persistently mapped CL_MEM_ALLOC_HOST_PTR buffer and
+// flush() copies everything allocated since the last flush into the
+// device side ring with a single write, instead of one write and one
+// event per upload. Slices start at multiples of the device's base address
+// alignment so they can be sub-buffers.
+//
+// Space is recycled through fences: fence(event) marks all slices
+// allocated so far as free once event completed, which should be the last
+// command reading them. When the ring is full allocate() waits for the
+// oldest fence and throws if nothing is fenced.
+//
+// Commands are enqueued on the queue that was current when the arena was
+// created, so use one arena per queue. Like Kernel, an arena must only be
+// used by one thread at a time.
+class StagingArena {
+public:
+	StagingArena(const Context &c, size_t bytes)
+		: capacity(0), head(0), tail(0), flushed(0), context(c), queue(c.getQueue())
+	{
+		alignment = std::max<size_t>(context.getDeviceInfo().base_address_alignment, 16);
+		capacity = (bytes + alignment - 1)/alignment*alignment;
+
+		cl_int error;
+		staging = clCreateBuffer(context.getContext(), CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, capacity, 0, &error);
+		checkError(error);
+		buffer = clCreateBuffer(context.getContext(), CL_MEM_READ_ONLY, capacity, 0, &error);
+		if(error != CL_SUCCESS)
+		{
+			clReleaseMemObject(staging);
+			checkError(error);
+		}
+		host_ptr = static_cast<char*>(clEnqueueMapBuffer(queue, staging, CL_TRUE, CL_MAP_WRITE, 0, capacity, 0, 0, 0, &error));
+		if(error != CL_SUCCESS)
+		{
+			clReleaseMemObject(buffer);
+			clReleaseMemObject(staging);
+			checkError(error);
+		}
+	}
+
+	// uninitialized room for count elements, fill it through the slice
+	template<class T>
+	Slice<T> allocate(size_t count = 1)
+	{
+		const size_t bytes = count*sizeof(T);
+		if(bytes == 0 || bytes > capacity)
+			throw std::runtime_error("invalid staging allocation size");
+		cl_ulong position = (head + alignment - 1)/alignment*alignment;
+		if(position % capacity + bytes > capacity)
+			position = (position/capacity + 1)*capacity;
+		reserve(position + bytes);
+		if(position/capacity != flushed/capacity)
+		{
+			// starting over at the beginning of the ring, flush the rest
+			// of the previous round to keep the range to flush contiguous
+			if(head != flushed)
+				flush();
+			flushed = position;
+		}
+		head = position + bytes;
+
+		const size_t offset = size_t(position % capacity);
+		cl_buffer_region region = {offset, bytes};
+		cl_int error;
+		cl_mem mem = clCreateSubBuffer(buffer, CL_MEM_READ_ONLY, CL_BUFFER_CREATE_TYPE_REGION, &region, &error);
+		checkError(error);
+		return Slice<T>(mem, reinterpret_cast<T*>(host_ptr + offset), count, offset);
+	}
+
+	template<class T>
+	Slice<T> upload(const T *values, size_t count)
+	{
+		Slice<T> slice = allocate<T>(count);
+		std::memcpy(slice.data(), values, count*sizeof(T));
+		return slice;
+	}
+
+	template<class T>
+	Slice<T> upload(const T &value)
+	{
+		return upload(&value, 1);
+	}
+
+	// Copies the slices allocated since the last flush to the device.
+	// Launches on the same in-order queue see the data without waiting.
+	Event flush()
+	{
+		return flush(0, 0);
+	}
+
+	Event flush(const Event &event)
+	{
+		return flush(1, event.getEventPtr());
+	}
+
+	Event flush(cl_uint event_count, const cl_event *events)
+	{
+		CLP_TRACE_SCOPE("StagingArena::flush");
+		cl_event e;
+		cl_int error;
+		const size_t offset = size_t(flushed % capacity);
+		const size_t bytes = size_t(head - flushed);
+		if(bytes)
+			error = clEnqueueWriteBuffer(queue, buffer, CL_FALSE, offset, bytes, host_ptr + offset, event_count, events, &e);
+		else
+			error = clEnqueueMarkerWithWaitList(queue, event_count, events, &e);
+		checkError(error);
+		CLP_TRACE_DEVICE(queue, e, event_count, events, bytes);
+		flushed = head;
+		event = Event(e);
+		return event;
+	}
+
+	// The slices allocated so far are reused once event completed.
+	void fence(const Event &event)
+	{
+		if(head != flushed)
+			throw std::runtime_error("StagingArena not flushed");
+		if(fences.empty() || fences.back().first != head)
+			fences.push_back(std::make_pair(head, event));
+		else
+			fences.back().second = event;
+	}
+
+	// waits for all fences and starts over at the beginning of the ring
+	void reset()
+	{
+		while(!fences.empty())
+			retire();
+		if(head != tail)
+			throw std::runtime_error("StagingArena has unfenced slices");
+		head = tail = flushed = 0;
+	}
+
+	size_t getCapacity() const { return capacity; }
+	size_t getAlignment() const { return alignment; }
+	// bytes held by slices that have not been recycled yet
+	size_t getUsed() const { return size_t(head - tail); }
+	const cl_mem* getMem() const { return &buffer; }
+	Event getLastEvent() { return event; }
+
+	~StagingArena()
+	{
+		// the runtime defers the release until enqueued commands finished
+		clEnqueueUnmapMemObject(queue, staging, host_ptr, 0, 0, 0);
+		clReleaseMemObject(staging);
+		clReleaseMemObject(buffer);
+	}
+private:
+	StagingArena(const StagingArena&);
+	StagingArena& operator=(const StagingArena&);
+
+	void reserve(cl_ulong end)
+	{
+		while(end - tail > capacity)
+		{
+			if(fences.empty())
+				throw std::runtime_error("StagingArena full, fence the slices in use");
+			retire();
+		}
+	}
+
+	void retire()
+	{
+		fences.front().second.wait();
+		tail = fences.front().first;
+		fences.pop_front();
+	}
+
+	// positions increase monotonically, the offset in the ring is the
+	// position modulo capacity
+	size_t alignment;
+	size_t capacity;
+	cl_ulong head;
+	cl_ulong tail;
+	cl_ulong flushed;
+	std::deque<std::pair<cl_ulong, Event> > fences;
+	cl_mem staging;
+	cl_mem buffer;
+	char *host_ptr;
+	Event event;
+	Context context;
+	cl_command_queue queue;
+};
+
+}
+
+#endif
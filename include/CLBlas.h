@@ -0,0 +1,262 @@
+#ifndef CL_BLAS_H
+#define CL_BLAS_H
+
+#include <algorithm>
+#include <memory>
+#include <sstream>
+#include <type_traits>
+
+#include "CLEvent.h"
+#include "CLContext.h"
+#include "CLBuffer.h"
+#include "CLProgram.h"
+
+namespace clp {
+
+// Dense matrix products on row major Buffer<T> data (T is cl_float or
+// cl_double). Tile size, register blocking and vector width are picked
+// from the device when the object is created. Like Kernel, a Blas object
+// must only be used by one thread at a time.
+template<class T>
+class Blas {
+public:
+	Blas(const Context &c)
+		: program(c), context(c)
+	{
+		const DeviceInfo &info = context.getDeviceInfo();
+		configure(info.max_work_group_size, info.local_memory_size, preferredVectorWidth<T>(info));
+
+		program.setSource(source());
+		program.build();
+		gemm_kernel.reset(new GemmKernel(program.getKernel<GemmSignature>("gemm")));
+		batched_kernel.reset(new GemmKernel(program.getKernel<GemmSignature>("gemm_batched")));
+		gemv_kernel.reset(new GemvKernel(program.getKernel<GemvSignature>("gemv")));
+	}
+
+	// C = alpha*A*B + beta*C with A MxK, B KxN and C MxN
+	Event gemm(cl_uint M, cl_uint N, cl_uint K, T alpha, const Buffer<T> &A, const Buffer<T> &B, T beta, Buffer<T> &C)
+	{
+		return gemm(M, N, K, alpha, A, B, beta, C, 0, 0);
+	}
+
+	Event gemm(cl_uint M, cl_uint N, cl_uint K, T alpha, const Buffer<T> &A, const Buffer<T> &B, T beta, Buffer<T> &C, const Event &event)
+	{
+		return gemm(M, N, K, alpha, A, B, beta, C, 1, event.getEventPtr());
+	}
+
+	Event gemm(cl_uint M, cl_uint N, cl_uint K, T alpha, const Buffer<T> &A, const Buffer<T> &B, T beta, Buffer<T> &C, cl_uint event_count, const cl_event *events)
+	{
+		checkSize(A, size_t(M)*K);
+		checkSize(B, size_t(K)*N);
+		checkSize(C, size_t(M)*N);
+		const Worksize ws(roundUp(N, tile)/tile*(tile/blocking), roundUp(M, tile), tile/blocking, tile);
+		return (*gemm_kernel)(ws, M, N, K, alpha, input(A), input(B), beta, C, event_count, events);
+	}
+
+	// count independent products of equally sized matrices stored back
+	// to back, aimed at many small matrices. Uses the tiled gemm kernel
+	// with the matrix index as third dimension, so a matrix up to the tile
+	// size is one work-group working from local memory.
+	Event gemmBatched(cl_uint count, cl_uint M, cl_uint N, cl_uint K, T alpha, const Buffer<T> &A, const Buffer<T> &B, T beta, Buffer<T> &C)
+	{
+		return gemmBatched(count, M, N, K, alpha, A, B, beta, C, 0, 0);
+	}
+
+	Event gemmBatched(cl_uint count, cl_uint M, cl_uint N, cl_uint K, T alpha, const Buffer<T> &A, const Buffer<T> &B, T beta, Buffer<T> &C, const Event &event)
+	{
+		return gemmBatched(count, M, N, K, alpha, A, B, beta, C, 1, event.getEventPtr());
+	}
+
+	Event gemmBatched(cl_uint count, cl_uint M, cl_uint N, cl_uint K, T alpha, const Buffer<T> &A, const Buffer<T> &B, T beta, Buffer<T> &C, cl_uint event_count, const cl_event *events)
+	{
+		checkSize(A, size_t(count)*M*K);
+		checkSize(B, size_t(count)*K*N);
+		checkSize(C, size_t(count)*M*N);
+		const Worksize ws(roundUp(N, tile)/tile*(tile/blocking), roundUp(M, tile), count, tile/blocking, tile, 1);
+		return (*batched_kernel)(ws, M, N, K, alpha, input(A), input(B), beta, C, event_count, events);
+	}
+
+	// y = alpha*A*x + beta*y with A MxN
+	Event gemv(cl_uint M, cl_uint N, T alpha, const Buffer<T> &A, const Buffer<T> &x, T beta, Buffer<T> &y)
+	{
+		return gemv(M, N, alpha, A, x, beta, y, 0, 0);
+	}
+
+	Event gemv(cl_uint M, cl_uint N, T alpha, const Buffer<T> &A, const Buffer<T> &x, T beta, Buffer<T> &y, const Event &event)
+	{
+		return gemv(M, N, alpha, A, x, beta, y, 1, event.getEventPtr());
+	}
+
+	Event gemv(cl_uint M, cl_uint N, T alpha, const Buffer<T> &A, const Buffer<T> &x, T beta, Buffer<T> &y, cl_uint event_count, const cl_event *events)
+	{
+		checkSize(A, size_t(M)*N);
+		checkSize(x, N);
+		checkSize(y, M);
+		const Worksize ws(size_t(M)*group, group);
+		return (*gemv_kernel)(ws, M, N, alpha, input(A), input(x), beta, y, Local<T>(group), event_count, events);
+	}
+
+	size_t getTileSize() const { return tile; }
+	size_t getBlocking() const { return blocking; }
+	size_t getVectorWidth() const { return vector; }
+private:
+	typedef void GemmSignature(cl_uint, cl_uint, cl_uint, T, T*, T*, T, T*);
+	typedef void GemvSignature(cl_uint, cl_uint, T, T*, T*, T, T*, Local<T>);
+	typedef Kernel<GemmSignature> GemmKernel;
+	typedef Kernel<GemvSignature> GemvKernel;
+
+	Blas(const Blas&);
+	Blas& operator=(const Blas&);
+
+	// the kernels only read their inputs, Kernel just has no const buffer arguments
+	static Buffer<T>& input(const Buffer<T> &b) { return const_cast<Buffer<T>&>(b); }
+
+	void configure(size_t max_group, cl_ulong local_memory, cl_uint vector_width)
+	{
+		// each thread accumulates vector_width columns of a tile in registers
+		vector = 1;
+		while(vector*2 <= vector_width && vector < 8)
+			vector *= 2;
+		tile = 16;
+		while(tile > 4 && (2*tile*tile*sizeof(T) > local_memory || tile*tile/std::min(vector, tile) > max_group))
+			tile /= 2;
+		blocking = std::min(vector, tile);
+		group = 1;
+		while(group*2 <= std::min<size_t>(max_group, 256))
+			group *= 2;
+	}
+
+	std::string source() const
+	{
+		const std::string type = type2name<T>::name();
+		std::ostringstream defines;
+		if(std::is_same<T, cl_double>::value)
+			defines << "#pragma OPENCL EXTENSION cl_khr_fp64 : enable\n";
+		defines << "#define T " << type << "\n";
+		defines << "#define TS " << tile << "\n";
+		defines << "#define WPT " << blocking << "\n";
+		defines << "#define VW " << vector << "\n";
+		if(vector > 1)
+		{
+			defines << "#define VT " << type << vector << "\n";
+			defines << "#define VLOAD vload" << vector << "\n";
+			defines << "#define VSUM(p) (";
+			for(size_t i = 0;i<vector;++i)
+				defines << (i ? " + " : "") << "(p).s" << "0123456789abcdef"[i];
+			defines << ")\n";
+		}
+		return defines.str() +
+		"#define RTS (TS/WPT)\n"
+		"\n"
+		"void gemm_tiles(const uint M, const uint N, const uint K, const T alpha,\n"
+		"	global const T *A, global const T *B, const T beta, global T *C,\n"
+		"	local T Asub[TS][TS], local T Bsub[TS][TS])\n"
+		"{\n"
+		"	const uint col = get_local_id(0);\n"
+		"	const uint row = get_local_id(1);\n"
+		"	const uint globalRow = TS*get_group_id(1) + row;\n"
+		"	const uint globalCol = TS*get_group_id(0) + col;\n"
+		"	T acc[WPT];\n"
+		"	for(uint w = 0;w<WPT;++w)\n"
+		"		acc[w] = 0;\n"
+		"	const uint tiles = (K + TS - 1)/TS;\n"
+		"	for(uint t = 0;t<tiles;++t)\n"
+		"	{\n"
+		"		for(uint w = 0;w<WPT;++w)\n"
+		"		{\n"
+		"			const uint tiledRow = TS*t + row;\n"
+		"			const uint tiledCol = TS*t + col + w*RTS;\n"
+		"			Asub[row][col + w*RTS] = (globalRow < M && tiledCol < K) ? A[globalRow*K + tiledCol] : 0;\n"
+		"			Bsub[row][col + w*RTS] = (tiledRow < K && globalCol + w*RTS < N) ? B[tiledRow*N + globalCol + w*RTS] : 0;\n"
+		"		}\n"
+		"		barrier(CLK_LOCAL_MEM_FENCE);\n"
+		"		for(uint k = 0;k<TS;++k)\n"
+		"		{\n"
+		"			const T a = Asub[row][k];\n"
+		"			for(uint w = 0;w<WPT;++w)\n"
+		"				acc[w] += a*Bsub[k][col + w*RTS];\n"
+		"		}\n"
+		"		barrier(CLK_LOCAL_MEM_FENCE);\n"
+		"	}\n"
+		"	for(uint w = 0;w<WPT;++w)\n"
+		"	{\n"
+		"		const uint c = globalCol + w*RTS;\n"
+		"		if(globalRow < M && c < N)\n"
+		"		{\n"
+		"			const uint index = globalRow*N + c;\n"
+		"			C[index] = beta == 0 ? alpha*acc[w] : alpha*acc[w] + beta*C[index];\n"
+		"		}\n"
+		"	}\n"
+		"}\n"
+		"\n"
+		"kernel void gemm(const uint M, const uint N, const uint K, const T alpha,\n"
+		"	global const T *A, global const T *B, const T beta, global T *C)\n"
+		"{\n"
+		"	local T Asub[TS][TS];\n"
+		"	local T Bsub[TS][TS];\n"
+		"	gemm_tiles(M, N, K, alpha, A, B, beta, C, Asub, Bsub);\n"
+		"}\n"
+		"\n"
+		"kernel void gemm_batched(const uint M, const uint N, const uint K, const T alpha,\n"
+		"	global const T *A, global const T *B, const T beta, global T *C)\n"
+		"{\n"
+		"	local T Asub[TS][TS];\n"
+		"	local T Bsub[TS][TS];\n"
+		"	const size_t batch = get_group_id(2);\n"
+		"	gemm_tiles(M, N, K, alpha, A + batch*M*K, B + batch*K*N, beta, C + batch*M*N, Asub, Bsub);\n"
+		"}\n"
+		"\n"
+		"kernel void gemv(const uint M, const uint N, const T alpha,\n"
+		"	global const T *A, global const T *x, const T beta, global T *y, local T *scratch)\n"
+		"{\n"
+		"	const uint row = get_group_id(0);\n"
+		"	const uint lid = get_local_id(0);\n"
+		"	const uint size = get_local_size(0);\n"
+		"	global const T *a = A + (size_t)row*N;\n"
+		"	T acc = 0;\n"
+		"	uint start = 0;\n"
+		"#if VW > 1\n"
+		"	const uint vectors = N/VW;\n"
+		"	for(uint j = lid;j<vectors;j += size)\n"
+		"	{\n"
+		"		const VT p = VLOAD(j, a)*VLOAD(j, x);\n"
+		"		acc += VSUM(p);\n"
+		"	}\n"
+		"	start = vectors*VW;\n"
+		"#endif\n"
+		"	for(uint j = start + lid;j<N;j += size)\n"
+		"		acc += a[j]*x[j];\n"
+		"	scratch[lid] = acc;\n"
+		"	barrier(CLK_LOCAL_MEM_FENCE);\n"
+		"	for(uint s = size/2;s>0;s >>= 1)\n"
+		"	{\n"
+		"		if(lid < s)\n"
+		"			scratch[lid] += scratch[lid + s];\n"
+		"		barrier(CLK_LOCAL_MEM_FENCE);\n"
+		"	}\n"
+		"	if(lid == 0)\n"
+		"		y[row] = beta == 0 ? alpha*scratch[0] : alpha*scratch[0] + beta*y[row];\n"
+		"}\n";
+	}
+
+	static size_t roundUp(size_t n, size_t multiple)
+	{
+		return (n + multiple - 1)/multiple*multiple;
+	}
+
+	static void checkSize(const Buffer<T> &b, size_t n)
+	{
+		if(b.size() < n)
+			throw std::runtime_error("buffer too short");
+	}
+
+	size_t tile, blocking, vector, group;
+	Program program;
+	std::unique_ptr<GemmKernel> gemm_kernel, batched_kernel;
+	std::unique_ptr<GemvKernel> gemv_kernel;
+	Context context;
+};
+
+}
+
+#endif
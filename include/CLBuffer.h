@@ -6,6 +6,15 @@
 
 namespace clp {
 
+template<class T>
+class Buffer;
+
+template<class E>
+struct Expression;
+
+template<class T, class E>
+Event assign(Buffer<T> &out, const Expression<E> &e);
+
 template<class T>
 class Buffer {
 public:
@@ -18,11 +27,18 @@ public:
     typedef size_t size_type;
 
 	Buffer(const Context &c, size_t s)
-		: host_ptr(0), buffersize(s), context(c)
+		: host_ptr(0), buffersize(s), resident(0), context(c)
 	{
-		cl_int error;
-		buffer = clCreateBuffer(context.getContext(), CL_MEM_READ_WRITE, buffersize*sizeof(value_type), 0, &error);
-		checkError(error);
+		create(CL_MEM_READ_WRITE, 0);
+	}
+
+	// flags are passed on to clCreateBuffer. With CL_MEM_USE_HOST_PTR or
+	// CL_MEM_COPY_HOST_PTR, source has to hold s elements, and for
+	// CL_MEM_USE_HOST_PTR it has to outlive the buffer.
+	Buffer(const Context &c, size_t s, cl_mem_flags flags, void *source)
+		: host_ptr(0), buffersize(s), resident(0), context(c)
+	{
+		create(flags, source);
 	}
 
 	Event map(cl_map_flags flags = CL_MAP_READ | CL_MAP_WRITE)
@@ -37,11 +53,17 @@ public:
 	
 	Event map(cl_map_flags flags, cl_uint event_count, const cl_event *events)
 	{
+		CLP_TRACE_SCOPE("Buffer::map");
 		check_unmapped();
+		if(resident)
+			context.getResidency()->pin(resident, context.getQueue());
 		cl_int error;
 		cl_event e;
 		host_ptr = static_cast<value_type*>(clEnqueueMapBuffer(context.getQueue(), buffer, CL_FALSE, flags, 0, buffersize*sizeof(value_type), event_count, events, &e, &error));
+		if(error != CL_SUCCESS && resident)
+			context.getResidency()->unpin(resident);
 		checkError(error);
+		CLP_TRACE_DEVICE(context.getQueue(), e, event_count, events, buffersize*sizeof(value_type));
 		event = Event(e);
 		return event;
 	}
@@ -58,11 +80,15 @@ public:
 	
 	Event unmap(cl_uint event_count, const cl_event *events)
 	{
+		CLP_TRACE_SCOPE("Buffer::unmap");
 		check_mapped();
 		cl_event e;
 		cl_int error = clEnqueueUnmapMemObject(context.getQueue(), buffer, host_ptr, event_count, events, &e);
 		host_ptr = 0;
+		if(resident)
+			context.getResidency()->unpin(resident);
 		checkError(error);
+		CLP_TRACE_DEVICE(context.getQueue(), e, event_count, events, buffersize*sizeof(value_type));
 		event = Event(e);
 		return event;
 	}
@@ -79,10 +105,14 @@ public:
 
 	Event read(value_type *destination, cl_uint event_count, const cl_event *events)
 	{
+		CLP_TRACE_SCOPE("Buffer::read");
 		check_unmapped();
+		if(resident)
+			context.getResidency()->use(resident, context.getQueue());
 		cl_event e;
 		cl_int error = clEnqueueReadBuffer (context.getQueue(), buffer, CL_FALSE, 0, buffersize*sizeof(value_type), destination, event_count, events, &e);
 		checkError(error);
+		CLP_TRACE_DEVICE(context.getQueue(), e, event_count, events, buffersize*sizeof(value_type));
 		event = Event(e);
 		return event;
 	}
@@ -99,12 +129,16 @@ public:
 	
 	Event readRange(size_t offset, size_t length, value_type *destination, cl_uint event_count, const cl_event *events)
 	{
+		CLP_TRACE_SCOPE("Buffer::readRange");
 		if(offset+length>buffersize)
 			throw std::runtime_error("buffer too short");
 		check_unmapped();
+		if(resident)
+			context.getResidency()->use(resident, context.getQueue());
 		cl_event e;
 		cl_int error = clEnqueueReadBuffer (context.getQueue(), buffer, CL_FALSE, offset*sizeof(value_type), length*sizeof(value_type), destination, event_count, events, &e);
 		checkError(error);
+		CLP_TRACE_DEVICE(context.getQueue(), e, event_count, events, length*sizeof(value_type));
 		event = Event(e);
 		return event;
 	}
@@ -121,10 +155,14 @@ public:
 	
 	Event write(const value_type *source, cl_uint event_count, const cl_event *events)
 	{
+		CLP_TRACE_SCOPE("Buffer::write");
 		check_unmapped();
+		if(resident)
+			context.getResidency()->use(resident, context.getQueue());
 		cl_event e;
 		cl_int error = clEnqueueWriteBuffer (context.getQueue(), buffer, CL_FALSE, 0, buffersize*sizeof(value_type), source, event_count, events, &e);
 		checkError(error);
+		CLP_TRACE_DEVICE(context.getQueue(), e, event_count, events, buffersize*sizeof(value_type));
 		event = Event(e);
 		return event;
 	}
@@ -141,12 +179,16 @@ public:
 	
 	Event writeRange(size_t offset, size_t length, const value_type *source, cl_uint event_count, const cl_event *events)
 	{
+		CLP_TRACE_SCOPE("Buffer::writeRange");
 		if(offset+length>buffersize)
 			throw std::runtime_error("buffer too short");
 		check_unmapped();
+		if(resident)
+			context.getResidency()->use(resident, context.getQueue());
 		cl_event e;
 		cl_int error = clEnqueueWriteBuffer (context.getQueue(), buffer, CL_FALSE, offset*sizeof(value_type), length*sizeof(value_type), source, event_count, events, &e);
 		checkError(error);
+		CLP_TRACE_DEVICE(context.getQueue(), e, event_count, events, length*sizeof(value_type));
 		event = Event(e);
 		return event;
 	}
@@ -172,18 +214,64 @@ public:
     
     inline size_type size() const { return buffersize; }
 
-	const cl_mem* getMem() const { return &buffer; }
+	// evaluates an elementwise expression, see CLExpression.h
+	template<class E>
+	Buffer& operator=(const Expression<E> &e)
+	{
+		event = assign(*this, e);
+		return *this;
+	}
+
+	// restores an evicted buffer, see Context::setMemoryBudget
+	const cl_mem* getMem() const { makeResident(); return &buffer; }
+	const Context& getContext() const { return context; }
 	Event getLastEvent() { return event; }
 	
 	bool isMapped() const { return host_ptr != 0; }
+
+	// Keeps the buffer on the device, for storage that other memory
+	// objects alias such as images created from the buffer. The aliasing
+	// object passes the returned entry to Residency::unpin once it is
+	// released, null when the context has no memory budget.
+	Residency::Entry* pin()
+	{
+		if(resident)
+			context.getResidency()->pin(resident, context.getQueue());
+		return resident;
+	}
 		
 	~Buffer()
 	{
-		clReleaseMemObject(buffer);
+		if(resident && host_ptr)
+			context.getResidency()->unpin(resident);
+		if(resident)
+			context.getResidency()->remove(resident);
+		else
+			clReleaseMemObject(buffer);
 	}
 private:
 	Buffer(const Buffer&) { }
 	Buffer& operator=(const Buffer&) { return *this; }
+
+	void create(cl_mem_flags flags, void *source)
+	{
+		// buffers over host memory are left to the runtime
+		Residency *residency = context.getResidency();
+		if(residency && !(flags & CL_MEM_USE_HOST_PTR))
+		{
+			resident = residency->add(&buffer, buffersize*sizeof(value_type), flags, source, context.getQueue());
+			return;
+		}
+		cl_int error;
+		buffer = clCreateBuffer(context.getContext(), flags, buffersize*sizeof(value_type), source, &error);
+		checkError(error);
+	}
+
+	inline void makeResident() const
+	{
+		if(resident)
+			context.getResidency()->touch(resident, context.getQueue());
+	}
 	
 	inline void check_mapped() const
     {
@@ -200,6 +288,7 @@ private:
 	value_type *host_ptr;
 	size_t buffersize;
 	cl_mem buffer;
+	Residency::Entry *resident;
 	Event event;
 	Context context;
 };
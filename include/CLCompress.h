@@ -0,0 +1,503 @@
+#ifndef CL_COMPRESS_H
+#define CL_COMPRESS_H
+
+#include <algorithm>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include "CLEvent.h"
+#include "CLContext.h"
+#include "CLBuffer.h"
+#include "CLProgram.h"
+
+namespace clp {
+
+namespace detail {
+
+// Frame of reference bit packing of blocks of 256 integers widened to 32
+// bits. A block has a header of four words: its first value (used by
+// delta blocks), the reference subtracted from every value, the bit width
+// and the offset of its packed words in the payload. Values are packed
+// LSB first, so the 256*width bits of a block take exactly 8*width words.
+// With delta coding the block packs the differences of neighbouring
+// values instead, which suits counters, timestamps and smooth signals.
+struct Packing {
+	static const size_t block = 256;
+	static const size_t header = 4;
+	// the payload ends in spare words so that every value can be read as
+	// a 64 bit window, including the empty words of zero width blocks
+	static const size_t padding = 2;
+
+	static cl_uint bitWidth(cl_uint bits)
+	{
+		cl_uint width = 0;
+		while(width < 32 && (bits >> width))
+			++width;
+		return width;
+	}
+
+	// values holds count <= block values and is packed in place. The
+	// reference is the smallest value, compared as signed integers for
+	// signed data and for differences, which may be negative.
+	static void encodeBlock(cl_uint *values, size_t count, bool delta, bool is_signed, cl_uint *head, std::vector<cl_uint> &payload)
+	{
+		const cl_uint base = values[0];
+		if(delta)
+		{
+			for(size_t j = count - 1;j>0;--j)
+				values[j] -= values[j - 1];
+			values[0] = 0;
+		}
+		cl_uint reference = values[0];
+		if(delta || is_signed)
+			for(size_t j = 1;j<count;++j)
+				reference = cl_int(values[j]) < cl_int(reference) ? values[j] : reference;
+		else
+			for(size_t j = 1;j<count;++j)
+				reference = std::min(reference, values[j]);
+		for(size_t j = count;j<block;++j)
+			values[j] = reference;
+		cl_uint bits = 0;
+		for(size_t j = 0;j<block;++j)
+		{
+			values[j] -= reference;
+			bits |= values[j];
+		}
+		const cl_uint width = bitWidth(bits);
+
+		// scatters each value into the words it covers without branching,
+		// a value straddling two words spills its upper bits into the
+		// second one
+		cl_uint words[8*32 + 1] = {};
+		for(size_t j = 0;j<block;++j)
+		{
+			const size_t position = j*width;
+			const cl_ulong v = cl_ulong(values[j]) << (position & 31);
+			words[position >> 5] |= cl_uint(v);
+			words[(position >> 5) + 1] |= cl_uint(v >> 32);
+		}
+		head[0] = base;
+		head[1] = reference;
+		head[2] = width;
+		head[3] = cl_uint(payload.size());
+		payload.insert(payload.end(), words, words + 8*width);
+	}
+
+	// unpacks the 256 values of a block into values
+	static void decodeBlock(const cl_uint *head, const cl_uint *payload, bool delta, cl_uint *values)
+	{
+		const cl_uint reference = head[1];
+		const cl_uint width = head[2];
+		const cl_uint *words = payload + head[3];
+		const cl_ulong mask = (cl_ulong(1) << width) - 1;
+		for(size_t j = 0;j<block;++j)
+		{
+			const size_t position = j*width;
+			const cl_ulong pair = words[position >> 5] | (cl_ulong(words[(position >> 5) + 1]) << 32);
+			values[j] = cl_uint((pair >> (position & 31)) & mask) + reference;
+		}
+		if(delta)
+		{
+			values[0] = head[0];
+			for(size_t j = 1;j<block;++j)
+				values[j] += values[j - 1];
+		}
+	}
+
+	// checks headers and payload of count values, as received from outside
+	static void check(const std::vector<cl_uint> &headers, const std::vector<cl_uint> &payload, size_t count)
+	{
+		const size_t blocks = (count + block - 1)/block;
+		if(headers.size() < blocks*header)
+			throw std::runtime_error("compressed headers too short");
+		for(size_t b = 0;b<blocks;++b)
+		{
+			const cl_uint *head = &headers[b*header];
+			if(head[2] > 32 || size_t(head[3]) + 8*head[2] + padding > payload.size())
+				throw std::runtime_error("compressed payload too short");
+		}
+	}
+};
+
+}
+
+// Transfers of integer buffers in compressed form: the host packs the
+// data in blocks of 256 values with the smallest bit width that holds
+// each block relative to its minimum (see detail::Packing), uploads the
+// packed words and a kernel unpacks them into the target buffer. Reads
+// pack on the device and unpack on the host. Only the packed bytes cross
+// the bus, so transfers of data with a small range per block, or with
+// small steps when delta coding is enabled, get faster by the compression
+// ratio as long as the bus and not the packing is the bottleneck.
+//
+// T is a signed or unsigned integer of up to 32 bits. The compressed form
+// is staged in buffers that grow to the largest transfer. Like Kernel, a
+// Compressor must only be used by one thread at a time.
+template<class T>
+class Compressor {
+public:
+	static_assert(std::is_integral<T>::value && sizeof(T) <= 4, "Compressor needs integers of up to 32 bits");
+
+	Compressor(const Context &c, bool d = false)
+		: delta(d), ratio(1), program(c), context(c)
+	{
+		group = 1;
+		while(group*2 <= std::min<size_t>(context.getDeviceInfo().max_work_group_size, detail::Packing::block))
+			group *= 2;
+
+		program.setSource(source());
+		program.build();
+		decode_kernel.reset(new DecodeKernel(program.getKernel<DecodeSignature>("clp_unpack")));
+		headers_kernel.reset(new HeadersKernel(program.getKernel<HeadersSignature>("clp_pack_headers")));
+		pack_kernel.reset(new PackKernel(program.getKernel<PackSignature>("clp_pack")));
+	}
+
+	// packs target.size() values of source and unpacks them into target,
+	// source is packed before returning and can be reused right away
+	Event write(Buffer<T> &target, const T *source)
+	{
+		return writeRange(target, 0, target.size(), source, 0, 0);
+	}
+
+	Event write(Buffer<T> &target, const T *source, const Event &event)
+	{
+		return writeRange(target, 0, target.size(), source, 1, event.getEventPtr());
+	}
+
+	Event write(Buffer<T> &target, const T *source, cl_uint event_count, const cl_event *events)
+	{
+		return writeRange(target, 0, target.size(), source, event_count, events);
+	}
+
+	Event writeRange(Buffer<T> &target, size_t offset, size_t length, const T *source)
+	{
+		return writeRange(target, offset, length, source, 0, 0);
+	}
+
+	Event writeRange(Buffer<T> &target, size_t offset, size_t length, const T *source, const Event &event)
+	{
+		return writeRange(target, offset, length, source, 1, event.getEventPtr());
+	}
+
+	Event writeRange(Buffer<T> &target, size_t offset, size_t length, const T *source, cl_uint event_count, const cl_event *events)
+	{
+		CLP_TRACE_SCOPE("Compressor::writeRange");
+		checkRange(target, offset, length);
+		if(length == 0)
+		{
+			cl_event e;
+			checkError(clEnqueueMarkerWithWaitList(context.getQueue(), event_count, events, &e));
+			CLP_TRACE_DEVICE(context.getQueue(), e, event_count, events, 0);
+			return Event(e);
+		}
+		// the previous upload may still read the staging vectors
+		if(pending.isValid())
+			pending.wait();
+		// packing is done on the host, so source is read before returning
+		encode(source, length, delta, host_headers, host_payload);
+		reserve(device_headers, host_headers.size());
+		reserve(device_payload, host_payload.size());
+		Event h = device_headers->writeRange(0, host_headers.size(), host_headers.data(), event_count, events);
+		Event p = device_payload->writeRange(0, host_payload.size(), host_payload.data(), h);
+		const size_t blocks = host_headers.size()/detail::Packing::header;
+		pending = (*decode_kernel)(Worksize(blocks*group, group), *device_headers, *device_payload, target, cl_uint(offset), cl_uint(length), cl_uint(delta), p);
+		updateRatio(length);
+		return pending;
+	}
+
+	// packs source on the device, reads the packed form and unpacks it
+	// into destination, blocking until destination is filled
+	void read(const Buffer<T> &source, T *destination)
+	{
+		readRange(source, 0, source.size(), destination, 0, 0);
+	}
+
+	void read(const Buffer<T> &source, T *destination, const Event &event)
+	{
+		readRange(source, 0, source.size(), destination, 1, event.getEventPtr());
+	}
+
+	void read(const Buffer<T> &source, T *destination, cl_uint event_count, const cl_event *events)
+	{
+		readRange(source, 0, source.size(), destination, event_count, events);
+	}
+
+	void readRange(const Buffer<T> &source, size_t offset, size_t length, T *destination)
+	{
+		readRange(source, offset, length, destination, 0, 0);
+	}
+
+	void readRange(const Buffer<T> &source, size_t offset, size_t length, T *destination, const Event &event)
+	{
+		readRange(source, offset, length, destination, 1, event.getEventPtr());
+	}
+
+	void readRange(const Buffer<T> &source, size_t offset, size_t length, T *destination, cl_uint event_count, const cl_event *events)
+	{
+		CLP_TRACE_SCOPE("Compressor::readRange");
+		checkRange(source, offset, length);
+		if(pending.isValid())
+			pending.wait();
+		if(length == 0)
+			return;
+		const size_t blocks = (length + detail::Packing::block - 1)/detail::Packing::block;
+		const Worksize ws(blocks*group, group);
+		host_headers.resize(blocks*detail::Packing::header);
+		reserve(device_headers, host_headers.size());
+
+		// the bit widths are known only after a first pass, the host then
+		// lays out the payload and a second pass packs the blocks into it
+		Event e = (*headers_kernel)(ws, input(source), cl_uint(offset), cl_uint(length), *device_headers, cl_uint(delta), event_count, events);
+		device_headers->readRange(0, host_headers.size(), host_headers.data(), e).wait();
+		size_t words = 0;
+		for(size_t b = 0;b<blocks;++b)
+		{
+			host_headers[b*detail::Packing::header + 3] = cl_uint(words);
+			words += 8*host_headers[b*detail::Packing::header + 2];
+		}
+		host_payload.resize(words + detail::Packing::padding);
+		reserve(device_payload, host_payload.size());
+		e = device_headers->writeRange(0, host_headers.size(), host_headers.data());
+		e = (*pack_kernel)(ws, input(source), cl_uint(offset), cl_uint(length), *device_headers, *device_payload, cl_uint(delta), e);
+		device_payload->readRange(0, words, host_payload.data(), e).wait();
+		decode(host_headers, host_payload, length, delta, destination);
+		updateRatio(length);
+	}
+
+	// compressed bytes of the last transfer relative to its raw size
+	double getLastRatio() const { return ratio; }
+	bool isDelta() const { return delta; }
+
+	// The host side of the format, e.g. to store data compressed. headers
+	// and payload are replaced by the packed form of count values.
+	static void encode(const T *source, size_t count, bool delta, std::vector<cl_uint> &headers, std::vector<cl_uint> &payload)
+	{
+		const size_t block = detail::Packing::block;
+		const size_t blocks = (count + block - 1)/block;
+		headers.resize(blocks*detail::Packing::header);
+		payload.clear();
+		cl_uint values[block];
+		for(size_t b = 0;b<blocks;++b)
+		{
+			const size_t first = b*block;
+			const size_t n = std::min(block, count - first);
+			for(size_t j = 0;j<n;++j)
+				values[j] = cl_uint(source[first + j]);
+			detail::Packing::encodeBlock(values, n, delta, std::is_signed<T>::value, &headers[b*detail::Packing::header], payload);
+		}
+		payload.resize(payload.size() + detail::Packing::padding, 0);
+	}
+
+	static void decode(const std::vector<cl_uint> &headers, const std::vector<cl_uint> &payload, size_t count, bool delta, T *destination)
+	{
+		detail::Packing::check(headers, payload, count);
+		const size_t block = detail::Packing::block;
+		const size_t blocks = (count + block - 1)/block;
+		cl_uint values[block];
+		for(size_t b = 0;b<blocks;++b)
+		{
+			const size_t first = b*block;
+			const size_t n = std::min(block, count - first);
+			detail::Packing::decodeBlock(&headers[b*detail::Packing::header], payload.data(), delta, values);
+			for(size_t j = 0;j<n;++j)
+				destination[first + j] = T(values[j]);
+		}
+	}
+
+	// the last upload may still read the host side headers and payload
+	~Compressor()
+	{
+		if(pending.isValid())
+			pending.wait();
+	}
+private:
+	typedef void DecodeSignature(cl_uint*, cl_uint*, T*, cl_uint, cl_uint, cl_uint);
+	typedef void HeadersSignature(T*, cl_uint, cl_uint, cl_uint*, cl_uint);
+	typedef void PackSignature(T*, cl_uint, cl_uint, cl_uint*, cl_uint*, cl_uint);
+	typedef Kernel<DecodeSignature> DecodeKernel;
+	typedef Kernel<HeadersSignature> HeadersKernel;
+	typedef Kernel<PackSignature> PackKernel;
+
+	Compressor(const Compressor&);
+	Compressor& operator=(const Compressor&);
+
+	// the kernels only read their inputs, Kernel just has no const buffer arguments
+	static Buffer<T>& input(const Buffer<T> &b) { return const_cast<Buffer<T>&>(b); }
+
+	static void checkRange(const Buffer<T> &b, size_t offset, size_t length)
+	{
+		if(offset > b.size() || length > b.size() - offset)
+			throw std::runtime_error("buffer too short");
+		if(offset + length > 0xffffffffu)
+			throw std::runtime_error("Compressor transfers are limited to 2^32 elements");
+	}
+
+	void reserve(std::unique_ptr< Buffer<cl_uint> > &b, size_t n)
+	{
+		if(!b || b->size() < n)
+			b.reset(new Buffer<cl_uint>(context, std::max<size_t>(n, b ? b->size()*2 : 0)));
+	}
+
+	void updateRatio(size_t length)
+	{
+		const size_t bytes = (host_headers.size() + host_payload.size())*sizeof(cl_uint);
+		ratio = length ? double(bytes)/(length*sizeof(T)) : 1;
+	}
+
+	std::string source() const
+	{
+		std::ostringstream defines;
+		defines << "#define T " << type2name<T>::name() << "\n";
+		defines << "#define IS_SIGNED " << (std::is_signed<T>::value ? 1 : 0) << "\n";
+		defines << "#define BLOCK " << detail::Packing::block << "\n";
+		return defines.str() +
+		"\n"
+		"// widened value j of the block starting at first, or its difference to\n"
+		"// the previous one\n"
+		"uint element(global const T *in, uint first, uint j, uint delta)\n"
+		"{\n"
+		"	const uint v = (uint)in[first + j];\n"
+		"	return delta ? (j ? v - (uint)in[first + j - 1] : 0) : v;\n"
+		"}\n"
+		"\n"
+		"kernel void clp_unpack(global const uint *headers, global const uint *payload, global T *out,\n"
+		"	const uint offset, const uint count, const uint delta)\n"
+		"{\n"
+		"	local uint values[BLOCK];\n"
+		"	local uint scratch[BLOCK];\n"
+		"	const uint block = get_group_id(0);\n"
+		"	const uint lid = get_local_id(0);\n"
+		"	const uint L = get_local_size(0);\n"
+		"	global const uint *head = headers + 4*block;\n"
+		"	const uint reference = head[1];\n"
+		"	const uint width = head[2];\n"
+		"	global const uint *words = payload + head[3];\n"
+		"	const ulong mask = ((ulong)1 << width) - 1;\n"
+		"	for(uint j = lid;j<BLOCK;j+=L)\n"
+		"	{\n"
+		"		const uint position = j*width;\n"
+		"		const ulong pair = words[position >> 5] | ((ulong)words[(position >> 5) + 1] << 32);\n"
+		"		values[j] = (uint)((pair >> (position & 31)) & mask) + reference;\n"
+		"	}\n"
+		"	if(delta)\n"
+		"	{\n"
+		"		// inclusive prefix sum of the differences\n"
+		"		barrier(CLK_LOCAL_MEM_FENCE);\n"
+		"		if(lid == 0)\n"
+		"			values[0] = head[0];\n"
+		"		barrier(CLK_LOCAL_MEM_FENCE);\n"
+		"		for(uint stride = 1;stride<BLOCK;stride<<=1)\n"
+		"		{\n"
+		"			for(uint j = lid;j<BLOCK;j+=L)\n"
+		"				scratch[j] = values[j] + (j >= stride ? values[j - stride] : 0);\n"
+		"			barrier(CLK_LOCAL_MEM_FENCE);\n"
+		"			for(uint j = lid;j<BLOCK;j+=L)\n"
+		"				values[j] = scratch[j];\n"
+		"			barrier(CLK_LOCAL_MEM_FENCE);\n"
+		"		}\n"
+		"	}\n"
+		"	const uint first = block*BLOCK;\n"
+		"	for(uint j = lid;j<BLOCK && first + j<count;j+=L)\n"
+		"		out[offset + first + j] = (T)values[j];\n"
+		"}\n"
+		"\n"
+		"// base, reference and bit width of every block, the host fills in the offsets\n"
+		"kernel void clp_pack_headers(global const T *in, const uint offset, const uint count,\n"
+		"	global uint *headers, const uint delta)\n"
+		"{\n"
+		"	local uint scratch[BLOCK];\n"
+		"	const uint block = get_group_id(0);\n"
+		"	const uint lid = get_local_id(0);\n"
+		"	const uint L = get_local_size(0);\n"
+		"	const uint first = block*BLOCK;\n"
+		"	const uint n = min((uint)BLOCK, count - first);\n"
+		"	in += offset;\n"
+		"	const int ordered_signed = delta || IS_SIGNED;\n"
+		"	uint low = element(in, first, 0, delta);\n"
+		"	for(uint j = lid;j<n;j+=L)\n"
+		"	{\n"
+		"		const uint v = element(in, first, j, delta);\n"
+		"		low = ordered_signed ? ((int)v < (int)low ? v : low) : min(v, low);\n"
+		"	}\n"
+		"	scratch[lid] = low;\n"
+		"	barrier(CLK_LOCAL_MEM_FENCE);\n"
+		"	for(uint s = L/2;s>0;s>>=1)\n"
+		"	{\n"
+		"		if(lid < s)\n"
+		"		{\n"
+		"			const uint a = scratch[lid], b = scratch[lid + s];\n"
+		"			scratch[lid] = ordered_signed ? ((int)b < (int)a ? b : a) : min(a, b);\n"
+		"		}\n"
+		"		barrier(CLK_LOCAL_MEM_FENCE);\n"
+		"	}\n"
+		"	const uint reference = scratch[0];\n"
+		"	barrier(CLK_LOCAL_MEM_FENCE);\n"
+		"	uint bits = 0;\n"
+		"	for(uint j = lid;j<n;j+=L)\n"
+		"		bits |= element(in, first, j, delta) - reference;\n"
+		"	scratch[lid] = bits;\n"
+		"	barrier(CLK_LOCAL_MEM_FENCE);\n"
+		"	for(uint s = L/2;s>0;s>>=1)\n"
+		"	{\n"
+		"		if(lid < s)\n"
+		"			scratch[lid] |= scratch[lid + s];\n"
+		"		barrier(CLK_LOCAL_MEM_FENCE);\n"
+		"	}\n"
+		"	if(lid == 0)\n"
+		"	{\n"
+		"		global uint *head = headers + 4*block;\n"
+		"		head[0] = (uint)in[first];\n"
+		"		head[1] = reference;\n"
+		"		head[2] = 32 - clz(scratch[0]);\n"
+		"		head[3] = 0;\n"
+		"	}\n"
+		"}\n"
+		"\n"
+		"// one work item per packed word, gathering the values overlapping it\n"
+		"kernel void clp_pack(global const T *in, const uint offset, const uint count,\n"
+		"	global const uint *headers, global uint *payload, const uint delta)\n"
+		"{\n"
+		"	const uint block = get_group_id(0);\n"
+		"	const uint lid = get_local_id(0);\n"
+		"	const uint L = get_local_size(0);\n"
+		"	const uint first = block*BLOCK;\n"
+		"	in += offset;\n"
+		"	global const uint *head = headers + 4*block;\n"
+		"	const uint reference = head[1];\n"
+		"	const uint width = head[2];\n"
+		"	global uint *words = payload + head[3];\n"
+		"	for(uint k = lid;k<8*width;k+=L)\n"
+		"	{\n"
+		"		const uint begin = 32*k/width;\n"
+		"		const uint end = min((32*k + 31)/width + 1, (uint)BLOCK);\n"
+		"		uint word = 0;\n"
+		"		for(uint j = begin;j<end;++j)\n"
+		"		{\n"
+		"			const uint v = first + j < count ? element(in, first, j, delta) - reference : 0;\n"
+		"			const int shift = (int)(j*width) - (int)(32*k);\n"
+		"			word |= shift >= 0 ? v << shift : v >> -shift;\n"
+		"		}\n"
+		"		words[k] = word;\n"
+		"	}\n"
+		"}\n";
+	}
+
+	bool delta;
+	size_t group;
+	double ratio;
+	Program program;
+	std::unique_ptr<DecodeKernel> decode_kernel;
+	std::unique_ptr<HeadersKernel> headers_kernel;
+	std::unique_ptr<PackKernel> pack_kernel;
+	std::unique_ptr< Buffer<cl_uint> > device_headers, device_payload;
+	std::vector<cl_uint> host_headers, host_payload;
+	Event pending;
+	Context context;
+};
+
+}
+
+#endif
@@ -5,6 +5,10 @@
 #include <string>
 #include <memory>
 #include <vector>
+#include <map>
+#include <mutex>
+#include <typeindex>
+#include <typeinfo>
 
 #define CL_USE_DEPRECATED_OPENCL_1_1_APIS
 #ifdef __APPLE__
@@ -14,15 +18,20 @@
 #endif
 
 #include "CLUtility.h"
+#include "CLDeviceInfo.h"
+#include "CLResidency.h"
 
 namespace clp
 {
 
 class Context {
 public:
-	Context(cl_device_type type = CL_DEVICE_TYPE_ALL, cl_uint requested_device = 0, cl_uint queuecount = 1)
+	Context(cl_device_type type = CL_DEVICE_TYPE_ALL, cl_uint requested_device = 0, cl_uint queuecount = 1, cl_command_queue_properties queue_properties = 0)
 		: data(new ContextData)
 	{
+#ifdef CLP_TRACE
+		queue_properties |= CL_QUEUE_PROFILING_ENABLE;
+#endif
 		cl_uint platforms, devices;
 		cl_int error;
 		error = clGetPlatformIDs(1, &(data->platform), &platforms);
@@ -40,6 +49,7 @@ public:
 			throw std::runtime_error("no such device");
 			
 		data->device = device_ids[requested_device];
+		data->device_info = DeviceInfo::get(data->device);
 			
 		cl_context_properties properties[]={
 			CL_CONTEXT_PLATFORM, (cl_context_properties)(data->platform),
@@ -50,7 +60,7 @@ public:
 		data->queues.resize(queuecount);
 		for(size_t i = 0;i<queuecount;++i)
 		{ 
-			data->queues[i] = clCreateCommandQueue(data->context, data->device, 0, &error);
+			data->queues[i] = clCreateCommandQueue(data->context, data->device, queue_properties, &error);
 			checkError(error);
 		}
 		data->current_queue = 0;
@@ -63,21 +73,97 @@ public:
 	
 	cl_platform_id getPlatform() const { return data->platform; }
 	cl_device_id getDevice() const { return data->device; }
+	const DeviceInfo& getDeviceInfo() const { return *data->device_info; }
 	cl_context getContext() const { return data->context; }
 	cl_command_queue getQueue() const { return data->queues[data->current_queue]; }
+	cl_command_queue getQueue(size_t i) const { return data->queues[i]; }
 	size_t getQueueCount() const { return data->queues.size(); }
 	void setCurrentQueue(size_t i) const { data->current_queue = i; }
 	size_t getCurrentQueue() const { return data->current_queue; }
+
+	// Limits the device memory held by buffers created from now on to
+	// bytes, evicting the least recently used ones to the host when
+	// needed, see CLResidency.h.
+	void setMemoryBudget(cl_ulong bytes) const
+	{
+		if(data->residency)
+			data->residency->setBudget(bytes);
+		else
+			data->residency.reset(new Residency(data->context, data->queues, bytes));
+	}
+
+	// null without a memory budget
+	Residency* getResidency() const { return data->residency.get(); }
+
+	// held from before binding kernel arguments until the launch is
+	// enqueued, see Residency
+	Residency::Launch beginLaunch() const
+	{
+		return Residency::Launch(data->residency.get());
+	}
+	
+	// Samplers are immutable, so identical ones are created once per context
+	// and shared. The returned handle is owned by the context.
+	cl_sampler getSampler(cl_bool normalized, cl_addressing_mode addressing, cl_filter_mode filter) const
+	{
+		const cl_ulong key = (cl_ulong(addressing) << 32) | (cl_ulong(filter) << 1) | (normalized ? 1 : 0);
+		std::lock_guard<std::mutex> lock(data->sampler_mutex);
+		std::map<cl_ulong, cl_sampler>::iterator i = data->samplers.find(key);
+		if(i != data->samplers.end())
+			return i->second;
+		cl_int error;
+		cl_sampler sampler = clCreateSampler(data->context, normalized, addressing, filter, &error);
+		checkError(error);
+		data->samplers[key] = sampler;
+		return sampler;
+	}
+
+	// Helper objects such as generated kernels, one per type T and context,
+	// constructed from the context on first use and destroyed with it. T
+	// must not hold a copy of the context, or the two keep each other alive.
+	// Only the lookup is locked, so objects of different types are built
+	// concurrently and a constructor may ask for other cached objects.
+	template<class T>
+	T& getCached() const
+	{
+		std::shared_ptr<CacheSlot> slot;
+		{
+			std::lock_guard<std::mutex> lock(data->cache_mutex);
+			std::shared_ptr<CacheSlot> &cached = data->cache[std::type_index(typeid(T))];
+			if(!cached)
+				cached.reset(new CacheSlot);
+			slot = cached;
+		}
+		std::call_once(slot->once, [&]() { slot->object.reset(new T(*this)); });
+		return *static_cast<T*>(slot->object.get());
+	}
 private:
+	struct CacheSlot {
+		std::once_flag once;
+		std::shared_ptr<void> object;
+	};
+
 	struct ContextData {
 		cl_platform_id platform;
 		cl_device_id device;
+		std::shared_ptr<const DeviceInfo> device_info;
 		cl_context context;
 		std::vector<cl_command_queue> queues;
 		size_t current_queue;
+		std::map<cl_ulong, cl_sampler> samplers;
+		std::mutex sampler_mutex;
+		std::map<std::type_index, std::shared_ptr<CacheSlot> > cache;
+		std::mutex cache_mutex;
+		std::unique_ptr<Residency> residency;
 		~ContextData()
 		{
+			cache.clear();
 			cl_int error;
+			for(std::map<cl_ulong, cl_sampler>::iterator i = samplers.begin();i!=samplers.end();++i)
+			{
+				error = clReleaseSampler(i->second);
+				checkError(error);
+			}
 			error = clReleaseContext(context);
 			checkError(error);
 			for(size_t i = 0;i<queues.size();++i)
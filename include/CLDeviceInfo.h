@@ -0,0 +1,157 @@
+#ifndef CL_DEVICEINFO_H
+#define CL_DEVICEINFO_H
+
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define CL_USE_DEPRECATED_OPENCL_1_1_APIS
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "CLUtility.h"
+
+namespace clp
+{
+
+// Device properties used for tuning, queried once per device. Get it from
+// Context::getDeviceInfo() instead of calling clGetDeviceInfo.
+struct DeviceInfo {
+	std::string name;
+	std::string vendor;
+	std::string version;
+	std::string extensions;
+	cl_device_type type;
+	// parsed from the version string
+	cl_uint version_major, version_minor;
+
+	cl_uint compute_units;
+	size_t max_work_group_size;
+	std::vector<size_t> max_work_item_sizes;
+
+	cl_ulong global_memory_size;
+	cl_ulong max_allocation_size;
+	cl_ulong local_memory_size;
+	cl_ulong max_constant_buffer_size;
+	cl_uint cacheline_size;
+	// in bytes, clGetDeviceInfo reports CL_DEVICE_MEM_BASE_ADDR_ALIGN in bits
+	cl_uint base_address_alignment;
+	// host and device share physical memory, e.g. CPUs and integrated GPUs
+	bool unified_memory;
+
+	bool image_support;
+	size_t image2d_max_width, image2d_max_height;
+
+	cl_uint preferred_vector_width_char;
+	cl_uint preferred_vector_width_short;
+	cl_uint preferred_vector_width_int;
+	cl_uint preferred_vector_width_long;
+	cl_uint preferred_vector_width_float;
+	// 0 without double support
+	cl_uint preferred_vector_width_double;
+
+	// 0 before OpenCL 2.0
+	cl_bitfield svm_capabilities;
+
+	bool hasExtension(const std::string &extension) const
+	{
+		const std::string padded = " " + extensions + " ";
+		return padded.find(" " + extension + " ") != std::string::npos;
+	}
+
+	bool isCpu() const { return (type & CL_DEVICE_TYPE_CPU) != 0; }
+
+	// Returns the shared, cached properties of device.
+	static std::shared_ptr<const DeviceInfo> get(cl_device_id device)
+	{
+		static std::mutex mutex;
+		static std::map<cl_device_id, std::shared_ptr<const DeviceInfo> > cache;
+		std::lock_guard<std::mutex> lock(mutex);
+		std::shared_ptr<const DeviceInfo> &info = cache[device];
+		if(!info)
+			info = std::make_shared<const DeviceInfo>(device);
+		return info;
+	}
+
+	explicit DeviceInfo(cl_device_id device)
+	{
+		name = queryString(device, CL_DEVICE_NAME);
+		vendor = queryString(device, CL_DEVICE_VENDOR);
+		version = queryString(device, CL_DEVICE_VERSION);
+		extensions = queryString(device, CL_DEVICE_EXTENSIONS);
+		type = query<cl_device_type>(device, CL_DEVICE_TYPE);
+		version_major = version_minor = 0;
+		std::sscanf(version.c_str(), "OpenCL %u.%u", &version_major, &version_minor);
+
+		compute_units = query<cl_uint>(device, CL_DEVICE_MAX_COMPUTE_UNITS);
+		max_work_group_size = query<size_t>(device, CL_DEVICE_MAX_WORK_GROUP_SIZE);
+		max_work_item_sizes.resize(query<cl_uint>(device, CL_DEVICE_MAX_WORK_ITEM_DIMENSIONS));
+		checkError(clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_ITEM_SIZES, max_work_item_sizes.size()*sizeof(size_t), max_work_item_sizes.data(), 0));
+
+		global_memory_size = query<cl_ulong>(device, CL_DEVICE_GLOBAL_MEM_SIZE);
+		max_allocation_size = query<cl_ulong>(device, CL_DEVICE_MAX_MEM_ALLOC_SIZE);
+		local_memory_size = query<cl_ulong>(device, CL_DEVICE_LOCAL_MEM_SIZE);
+		max_constant_buffer_size = query<cl_ulong>(device, CL_DEVICE_MAX_CONSTANT_BUFFER_SIZE);
+		cacheline_size = query<cl_uint>(device, CL_DEVICE_GLOBAL_MEM_CACHELINE_SIZE);
+		base_address_alignment = query<cl_uint>(device, CL_DEVICE_MEM_BASE_ADDR_ALIGN)/8;
+		unified_memory = query<cl_bool>(device, CL_DEVICE_HOST_UNIFIED_MEMORY) != CL_FALSE;
+
+		image_support = query<cl_bool>(device, CL_DEVICE_IMAGE_SUPPORT) != CL_FALSE;
+		image2d_max_width = image_support ? query<size_t>(device, CL_DEVICE_IMAGE2D_MAX_WIDTH) : 0;
+		image2d_max_height = image_support ? query<size_t>(device, CL_DEVICE_IMAGE2D_MAX_HEIGHT) : 0;
+
+		preferred_vector_width_char = query<cl_uint>(device, CL_DEVICE_PREFERRED_VECTOR_WIDTH_CHAR);
+		preferred_vector_width_short = query<cl_uint>(device, CL_DEVICE_PREFERRED_VECTOR_WIDTH_SHORT);
+		preferred_vector_width_int = query<cl_uint>(device, CL_DEVICE_PREFERRED_VECTOR_WIDTH_INT);
+		preferred_vector_width_long = query<cl_uint>(device, CL_DEVICE_PREFERRED_VECTOR_WIDTH_LONG);
+		preferred_vector_width_float = query<cl_uint>(device, CL_DEVICE_PREFERRED_VECTOR_WIDTH_FLOAT);
+		preferred_vector_width_double = query<cl_uint>(device, CL_DEVICE_PREFERRED_VECTOR_WIDTH_DOUBLE);
+
+		svm_capabilities = 0;
+#ifdef CL_VERSION_2_0
+		if(version_major >= 2)
+			svm_capabilities = query<cl_bitfield>(device, CL_DEVICE_SVM_CAPABILITIES);
+#endif
+	}
+private:
+	template<class T>
+	static T query(cl_device_id device, cl_device_info param)
+	{
+		T value;
+		checkError(clGetDeviceInfo(device, param, sizeof(T), &value, 0));
+		return value;
+	}
+
+	static std::string queryString(cl_device_id device, cl_device_info param)
+	{
+		size_t length;
+		checkError(clGetDeviceInfo(device, param, 0, 0, &length));
+		std::string value(length, '\0');
+		checkError(clGetDeviceInfo(device, param, length, &value[0], 0));
+		return value.c_str();
+	}
+};
+
+// preferred vector width for elements of type T, 1 for other types
+template<class T>
+inline cl_uint preferredVectorWidth(const DeviceInfo &) { return 1; }
+template<> inline cl_uint preferredVectorWidth<cl_char>(const DeviceInfo &d) { return d.preferred_vector_width_char; }
+template<> inline cl_uint preferredVectorWidth<cl_uchar>(const DeviceInfo &d) { return d.preferred_vector_width_char; }
+template<> inline cl_uint preferredVectorWidth<cl_short>(const DeviceInfo &d) { return d.preferred_vector_width_short; }
+template<> inline cl_uint preferredVectorWidth<cl_ushort>(const DeviceInfo &d) { return d.preferred_vector_width_short; }
+template<> inline cl_uint preferredVectorWidth<cl_int>(const DeviceInfo &d) { return d.preferred_vector_width_int; }
+template<> inline cl_uint preferredVectorWidth<cl_uint>(const DeviceInfo &d) { return d.preferred_vector_width_int; }
+template<> inline cl_uint preferredVectorWidth<cl_long>(const DeviceInfo &d) { return d.preferred_vector_width_long; }
+template<> inline cl_uint preferredVectorWidth<cl_ulong>(const DeviceInfo &d) { return d.preferred_vector_width_long; }
+template<> inline cl_uint preferredVectorWidth<cl_float>(const DeviceInfo &d) { return d.preferred_vector_width_float; }
+template<> inline cl_uint preferredVectorWidth<cl_double>(const DeviceInfo &d) { return d.preferred_vector_width_double; }
+
+}
+
+#endif
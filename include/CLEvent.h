@@ -9,6 +9,7 @@
 #endif
 
 #include "CLUtility.h"
+#include "CLTrace.h"
 
 namespace clp
 {
@@ -43,9 +44,12 @@ public:
 	
 	void wait()
 	{
+		CLP_TRACE_SCOPE("Event::wait");
 		checkError(clWaitForEvents(1,&event));
 	}
 	
+	bool isValid() const { return assigned; }
+	
 	operator cl_event() const { return event; }
 	
 	cl_event const* getEventPtr() const { return &event; }
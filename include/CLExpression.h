@@ -0,0 +1,388 @@
+#ifndef CL_EXPRESSION_H
+#define CL_EXPRESSION_H
+
+#include <mutex>
+#include <sstream>
+#include <type_traits>
+
+#include "CLEvent.h"
+#include "CLContext.h"
+#include "CLBuffer.h"
+#include "CLProgram.h"
+
+namespace clp {
+
+// Elementwise expressions over buffers, e.g. y = a*x + sin(y). Each
+// expression type is turned into one fused kernel that is compiled once
+// per context, so a chain of operations costs a single pass over memory.
+//
+// Nodes provide
+//   value_type                   the element type of the result
+//   static std::string code(std::string &params, int &index)
+//                                 the OpenCL C expression for element i,
+//                                 appending the kernel parameters it needs
+//   void bind(cl_kernel, cl_uint &index) const
+//                                 the matching clSetKernelArg calls
+//   void check(size_t n) const    validates buffer sizes
+// code depends on the node type only, which is what makes caching by
+// type possible.
+
+template<class E>
+struct Expression {
+	const E& self() const { return static_cast<const E&>(*this); }
+};
+
+template<class T>
+inline const char* expressionTypeName()
+{
+	const char *name = type2name<T>::name();
+	if(!name)
+		throw std::runtime_error("type not supported in expressions");
+	return name;
+}
+
+template<class T>
+class BufferTerm : public Expression< BufferTerm<T> > {
+public:
+	typedef T value_type;
+
+	BufferTerm(const Buffer<T> &b) : buffer(&b) { }
+
+	static std::string code(std::string &params, int &index)
+	{
+		std::ostringstream name;
+		name << "a" << index++;
+		params += std::string(", global const ") + expressionTypeName<T>() + " *" + name.str();
+		return name.str() + "[i]";
+	}
+
+	void bind(cl_kernel kernel, cl_uint &index) const
+	{
+		checkError(clSetKernelArg(kernel, index++, sizeof(cl_mem), buffer->getMem()));
+	}
+
+	void check(size_t n) const
+	{
+		if(buffer->size() < n)
+			throw std::runtime_error("buffer too short");
+		if(buffer->isMapped())
+			throw std::runtime_error("Buffer mapped");
+	}
+private:
+	const Buffer<T> *buffer;
+};
+
+template<class T>
+class ScalarTerm : public Expression< ScalarTerm<T> > {
+public:
+	typedef T value_type;
+
+	ScalarTerm(T v) : value(v) { }
+
+	static std::string code(std::string &params, int &index)
+	{
+		std::ostringstream name;
+		name << "a" << index++;
+		params += std::string(", ") + expressionTypeName<T>() + " " + name.str();
+		return name.str();
+	}
+
+	void bind(cl_kernel kernel, cl_uint &index) const
+	{
+		checkError(clSetKernelArg(kernel, index++, sizeof(T), &value));
+	}
+
+	void check(size_t) const { }
+private:
+	T value;
+};
+
+template<class Op, class A>
+class UnaryExpression : public Expression< UnaryExpression<Op, A> > {
+public:
+	typedef typename A::value_type value_type;
+
+	UnaryExpression(const A &a_) : a(a_) { }
+
+	static std::string code(std::string &params, int &index)
+	{
+		return Op::apply(A::code(params, index));
+	}
+
+	void bind(cl_kernel kernel, cl_uint &index) const { a.bind(kernel, index); }
+	void check(size_t n) const { a.check(n); }
+private:
+	A a;
+};
+
+template<class Op, class A, class B>
+class BinaryExpression : public Expression< BinaryExpression<Op, A, B> > {
+public:
+	typedef typename std::common_type<typename A::value_type, typename B::value_type>::type value_type;
+
+	BinaryExpression(const A &a_, const B &b_) : a(a_), b(b_) { }
+
+	static std::string code(std::string &params, int &index)
+	{
+		const std::string left = A::code(params, index);
+		return Op::apply(left, B::code(params, index));
+	}
+
+	void bind(cl_kernel kernel, cl_uint &index) const { a.bind(kernel, index); b.bind(kernel, index); }
+	void check(size_t n) const { a.check(n); b.check(n); }
+private:
+	A a;
+	B b;
+};
+
+template<class A, class B, class C>
+class ClampExpression : public Expression< ClampExpression<A, B, C> > {
+public:
+	typedef typename A::value_type value_type;
+
+	ClampExpression(const A &a_, const B &b_, const C &c_) : a(a_), b(b_), c(c_) { }
+
+	static std::string code(std::string &params, int &index)
+	{
+		const std::string x = A::code(params, index);
+		const std::string lo = B::code(params, index);
+		return "clamp(" + x + ", " + lo + ", " + C::code(params, index) + ")";
+	}
+
+	void bind(cl_kernel kernel, cl_uint &index) const { a.bind(kernel, index); b.bind(kernel, index); c.bind(kernel, index); }
+	void check(size_t n) const { a.check(n); b.check(n); c.check(n); }
+private:
+	A a;
+	B b;
+	C c;
+};
+
+// maps buffers and expressions to expression nodes
+template<class T, class Enable = void>
+struct ExpressionOperand {
+	static const bool value = false;
+};
+
+template<class T>
+struct ExpressionOperand< Buffer<T> > {
+	static const bool value = true;
+	typedef BufferTerm<T> type;
+	static type get(const Buffer<T> &b) { return type(b); }
+};
+
+template<class E>
+struct ExpressionOperand<E, typename std::enable_if< std::is_base_of<Expression<E>, E>::value >::type> {
+	static const bool value = true;
+	typedef E type;
+	static const E& get(const E &e) { return e; }
+};
+
+// scalars take the element type of the expression they are combined with
+template<class S, class E, class Enable = void>
+struct ScalarOperand {
+};
+
+template<class S, class E>
+struct ScalarOperand<S, E, typename std::enable_if<std::is_arithmetic<S>::value && ExpressionOperand<E>::value>::type> {
+	typedef ScalarTerm<typename ExpressionOperand<E>::type::value_type> type;
+	static type get(S s) { return type(typename type::value_type(s)); }
+};
+
+#define OPENCL_EXPRESSION_INFIX(NAME,SYMBOL)                                     \
+struct NAME {                                                                    \
+	static std::string apply(const std::string &a, const std::string &b)         \
+	{                                                                            \
+		return "(" + a + " " SYMBOL " " + b + ")";                               \
+	}                                                                            \
+};
+
+#define OPENCL_EXPRESSION_CALL1(NAME,FUNCTION)                                   \
+struct NAME {                                                                    \
+	static std::string apply(const std::string &a)                               \
+	{                                                                            \
+		return FUNCTION "(" + a + ")";                                           \
+	}                                                                            \
+};
+
+#define OPENCL_EXPRESSION_CALL2(NAME,FUNCTION)                                   \
+struct NAME {                                                                    \
+	static std::string apply(const std::string &a, const std::string &b)         \
+	{                                                                            \
+		return FUNCTION "(" + a + ", " + b + ")";                                 \
+	}                                                                            \
+};
+
+OPENCL_EXPRESSION_INFIX(PlusOp, "+")
+OPENCL_EXPRESSION_INFIX(MinusOp, "-")
+OPENCL_EXPRESSION_INFIX(MultipliesOp, "*")
+OPENCL_EXPRESSION_INFIX(DividesOp, "/")
+OPENCL_EXPRESSION_CALL1(NegateOp, "-")
+OPENCL_EXPRESSION_CALL1(SinOp, "sin")
+OPENCL_EXPRESSION_CALL1(CosOp, "cos")
+OPENCL_EXPRESSION_CALL1(TanOp, "tan")
+OPENCL_EXPRESSION_CALL1(ExpOp, "exp")
+OPENCL_EXPRESSION_CALL1(LogOp, "log")
+OPENCL_EXPRESSION_CALL1(SqrtOp, "sqrt")
+OPENCL_EXPRESSION_CALL1(FabsOp, "fabs")
+OPENCL_EXPRESSION_CALL2(MinOp, "min")
+OPENCL_EXPRESSION_CALL2(MaxOp, "max")
+OPENCL_EXPRESSION_CALL2(PowOp, "pow")
+
+#undef OPENCL_EXPRESSION_INFIX
+#undef OPENCL_EXPRESSION_CALL1
+#undef OPENCL_EXPRESSION_CALL2
+
+// binary operators and functions accept two operands or an operand and
+// an arithmetic scalar on either side
+#define OPENCL_EXPRESSION_BINARY(FUNCTION,OP)                                    \
+template<class A, class B>                                                       \
+typename std::enable_if<ExpressionOperand<A>::value && ExpressionOperand<B>::value, \
+	BinaryExpression<OP, typename ExpressionOperand<A>::type, typename ExpressionOperand<B>::type> >::type \
+FUNCTION(const A &a, const B &b)                                                 \
+{                                                                                \
+	return BinaryExpression<OP, typename ExpressionOperand<A>::type, typename ExpressionOperand<B>::type>( \
+		ExpressionOperand<A>::get(a), ExpressionOperand<B>::get(b));             \
+}                                                                                \
+template<class S, class B>                                                       \
+typename std::enable_if<std::is_arithmetic<S>::value && ExpressionOperand<B>::value, \
+	BinaryExpression<OP, typename ScalarOperand<S, B>::type, typename ExpressionOperand<B>::type> >::type \
+FUNCTION(S a, const B &b)                                                        \
+{                                                                                \
+	return BinaryExpression<OP, typename ScalarOperand<S, B>::type, typename ExpressionOperand<B>::type>( \
+		ScalarOperand<S, B>::get(a), ExpressionOperand<B>::get(b));              \
+}                                                                                \
+template<class A, class S>                                                       \
+typename std::enable_if<ExpressionOperand<A>::value && std::is_arithmetic<S>::value, \
+	BinaryExpression<OP, typename ExpressionOperand<A>::type, typename ScalarOperand<S, A>::type> >::type \
+FUNCTION(const A &a, S b)                                                        \
+{                                                                                \
+	return BinaryExpression<OP, typename ExpressionOperand<A>::type, typename ScalarOperand<S, A>::type>( \
+		ExpressionOperand<A>::get(a), ScalarOperand<S, A>::get(b));              \
+}
+
+#define OPENCL_EXPRESSION_UNARY(FUNCTION,OP)                                     \
+template<class A>                                                                \
+typename std::enable_if<ExpressionOperand<A>::value,                             \
+	UnaryExpression<OP, typename ExpressionOperand<A>::type> >::type             \
+FUNCTION(const A &a)                                                             \
+{                                                                                \
+	return UnaryExpression<OP, typename ExpressionOperand<A>::type>(ExpressionOperand<A>::get(a)); \
+}
+
+OPENCL_EXPRESSION_BINARY(operator+, PlusOp)
+OPENCL_EXPRESSION_BINARY(operator-, MinusOp)
+OPENCL_EXPRESSION_BINARY(operator*, MultipliesOp)
+OPENCL_EXPRESSION_BINARY(operator/, DividesOp)
+OPENCL_EXPRESSION_BINARY(min, MinOp)
+OPENCL_EXPRESSION_BINARY(max, MaxOp)
+OPENCL_EXPRESSION_BINARY(pow, PowOp)
+OPENCL_EXPRESSION_UNARY(operator-, NegateOp)
+OPENCL_EXPRESSION_UNARY(sin, SinOp)
+OPENCL_EXPRESSION_UNARY(cos, CosOp)
+OPENCL_EXPRESSION_UNARY(tan, TanOp)
+OPENCL_EXPRESSION_UNARY(exp, ExpOp)
+OPENCL_EXPRESSION_UNARY(log, LogOp)
+OPENCL_EXPRESSION_UNARY(sqrt, SqrtOp)
+OPENCL_EXPRESSION_UNARY(fabs, FabsOp)
+
+#undef OPENCL_EXPRESSION_BINARY
+#undef OPENCL_EXPRESSION_UNARY
+
+// clamp with scalar bounds
+template<class A, class S>
+typename std::enable_if<ExpressionOperand<A>::value && std::is_arithmetic<S>::value,
+	ClampExpression<typename ExpressionOperand<A>::type, typename ScalarOperand<S, A>::type, typename ScalarOperand<S, A>::type> >::type
+clamp(const A &a, S lo, S hi)
+{
+	return ClampExpression<typename ExpressionOperand<A>::type, typename ScalarOperand<S, A>::type, typename ScalarOperand<S, A>::type>(
+		ExpressionOperand<A>::get(a), ScalarOperand<S, A>::get(lo), ScalarOperand<S, A>::get(hi));
+}
+
+// One fused kernel per (output type, expression type) and context, cached
+// by the context. The kernel object is shared, so setting arguments and
+// enqueueing happen under a lock.
+template<class T, class E>
+class FusedKernel {
+public:
+	static Event launch(const Context &context, Buffer<T> &out, const E &e, cl_uint event_count, const cl_event *events)
+	{
+		FusedKernel &fused = context.getCached<FusedKernel>();
+		std::lock_guard<std::mutex> lock(fused.mutex);
+		cl_kernel kernel = fused.kernel;
+		CLP_TRACE_SCOPE("FusedKernel");
+		CLP_TRACE_KERNEL(kernel);
+		const Residency::Launch launch = context.beginLaunch();
+		const cl_ulong n = out.size();
+		cl_uint index = 0;
+		checkError(clSetKernelArg(kernel, index++, sizeof(cl_mem), out.getMem()));
+		checkError(clSetKernelArg(kernel, index++, sizeof(cl_ulong), &n));
+		e.bind(kernel, index);
+		const size_t global = out.size();
+		cl_event event;
+		checkError(clEnqueueNDRangeKernel(context.getQueue(), kernel, 1, 0, &global, 0, event_count, events, &event));
+		CLP_TRACE_DEVICE(context.getQueue(), event, event_count, events, 0);
+		return Event(event);
+	}
+
+	static std::string source()
+	{
+		std::string params;
+		int index = 0;
+		const std::string expression = E::code(params, index);
+		const std::string type = expressionTypeName<T>();
+		return "kernel void clp_fused(global " + type + " *out, ulong n" + params + ")\n"
+			"{\n"
+			"	const size_t i = get_global_id(0);\n"
+			"	if(i < n)\n"
+			"		out[i] = (" + type + ")" + expression + ";\n"
+			"}\n";
+	}
+
+	~FusedKernel()
+	{
+		clReleaseKernel(kernel);
+	}
+private:
+	friend class Context;
+
+	// the kernel keeps its program alive, the Program (which holds the
+	// context) is only needed to build it
+	FusedKernel(const Context &context)
+	{
+		Program program(context);
+		program.setSource(source());
+		program.build();
+		cl_int error;
+		kernel = clCreateKernel(program.getProgram(), "clp_fused", &error);
+		checkError(error);
+	}
+
+	cl_kernel kernel;
+	std::mutex mutex;
+};
+
+// evaluates an expression into out, element by element
+template<class T, class E>
+Event assign(Buffer<T> &out, const Expression<E> &e)
+{
+	return assign(out, e, 0, 0);
+}
+
+template<class T, class E>
+Event assign(Buffer<T> &out, const Expression<E> &e, const Event &event)
+{
+	return assign(out, e, 1, event.getEventPtr());
+}
+
+template<class T, class E>
+Event assign(Buffer<T> &out, const Expression<E> &e, cl_uint event_count, const cl_event *events)
+{
+	if(out.isMapped())
+		throw std::runtime_error("Buffer mapped");
+	e.self().check(out.size());
+	return FusedKernel<T, E>::launch(out.getContext(), out, e.self(), event_count, events);
+}
+
+}
+
+#endif
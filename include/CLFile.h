@@ -0,0 +1,263 @@
+#ifndef CL_FILE_H
+#define CL_FILE_H
+
+// Moving file contents into and out of buffers without staging copies in
+// host containers. POSIX only (mmap).
+
+#include <algorithm>
+#include <deque>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "CLEvent.h"
+#include "CLContext.h"
+#include "CLBuffer.h"
+
+namespace clp {
+
+// A file mapped into memory. Existing files are mapped copy on write, so
+// they can be modified in memory (e.g. by a device through a buffer that
+// uses the mapping) without touching the file. Files created with a size
+// are mapped shared and receive everything written to the mapping.
+class MappedFile {
+public:
+	explicit MappedFile(const std::string &path)
+		: writable(false)
+	{
+		const int fd = ::open(path.c_str(), O_RDONLY);
+		if(fd < 0)
+			throw std::runtime_error("cannot open " + path);
+		struct stat s;
+		if(::fstat(fd, &s) != 0)
+		{
+			::close(fd);
+			throw std::runtime_error("cannot stat " + path);
+		}
+		length = size_t(s.st_size);
+		map(fd, PROT_READ | PROT_WRITE, MAP_PRIVATE, path);
+	}
+
+	// creates or truncates path to bytes, an empty mapping is refused
+	// before the file is touched
+	MappedFile(const std::string &path, size_t bytes)
+		: length(bytes), writable(true)
+	{
+		if(bytes == 0)
+			throw std::runtime_error("cannot map empty file " + path);
+		const int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if(fd < 0)
+			throw std::runtime_error("cannot create " + path);
+		if(::ftruncate(fd, off_t(bytes)) != 0)
+		{
+			::close(fd);
+			throw std::runtime_error("cannot resize " + path);
+		}
+		map(fd, PROT_READ | PROT_WRITE, MAP_SHARED, path);
+	}
+
+	void* data() { return address; }
+	const void* data() const { return address; }
+	size_t size() const { return length; }
+	bool isWritable() const { return writable; }
+
+	// hints that the given byte range is needed soon, so the kernel can
+	// read it ahead while earlier chunks are transferred
+	void prefetch(size_t offset, size_t bytes) const
+	{
+		const size_t page = pageSize();
+		const size_t begin = offset/page*page;
+		if(begin < length)
+			::madvise(static_cast<char*>(address) + begin, std::min(offset + bytes, length) - begin, MADV_WILLNEED);
+	}
+
+	// writes modified pages of a created file back
+	void sync()
+	{
+		if(writable && ::msync(address, length, MS_SYNC) != 0)
+			throw std::runtime_error("msync failed");
+	}
+
+	static size_t pageSize()
+	{
+		return size_t(::sysconf(_SC_PAGESIZE));
+	}
+
+	~MappedFile()
+	{
+		::munmap(address, length);
+	}
+private:
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+
+	void map(int fd, int protection, int flags, const std::string &path)
+	{
+		if(length == 0)
+		{
+			::close(fd);
+			throw std::runtime_error("cannot map empty file " + path);
+		}
+		address = ::mmap(0, length, protection, flags, fd, 0);
+		::close(fd);
+		if(address == MAP_FAILED)
+			throw std::runtime_error("cannot map " + path);
+		::madvise(address, length, MADV_SEQUENTIAL);
+	}
+
+	void *address;
+	size_t length;
+	bool writable;
+};
+
+namespace detail {
+
+// keeps the mapping alive until the buffer using it is released
+struct MappedFileHolder {
+	MappedFileHolder(const std::string &path) : file(path) { }
+	MappedFileHolder(const std::string &path, size_t bytes) : file(path, bytes) { }
+	MappedFile file;
+};
+
+template<class T>
+size_t elementCount(const MappedFile &file)
+{
+	if(file.size() % sizeof(T))
+		throw std::runtime_error("file size is not a multiple of the element size");
+	return file.size()/sizeof(T);
+}
+
+// Transfers in flight over a file mapping, at most depth of them. They
+// all complete before the object is gone, also when unwinding from an
+// error, since they still read or write the mapping.
+class Transfers {
+public:
+	explicit Transfers(size_t d)
+		: depth(std::max<size_t>(d, 1))
+	{
+	}
+
+	// waits for the oldest transfer when depth are in flight
+	void reserve()
+	{
+		if(pending.size() >= depth)
+		{
+			pending.front().wait();
+			pending.pop_front();
+		}
+	}
+
+	void push(const Event &e) { pending.push_back(e); }
+
+	void finish()
+	{
+		while(!pending.empty())
+		{
+			pending.front().wait();
+			pending.pop_front();
+		}
+	}
+
+	~Transfers()
+	{
+		for(size_t i = 0;i<pending.size();++i)
+			if(pending[i].isValid())
+				clWaitForEvents(1, pending[i].getEventPtr());
+	}
+private:
+	Transfers(const Transfers&);
+	Transfers& operator=(const Transfers&);
+
+	std::deque<Event> pending;
+	size_t depth;
+};
+
+// chunk length in elements, rounded down to whole pages where possible
+template<class T>
+size_t chunkLength(size_t chunk_bytes)
+{
+	const size_t page = MappedFile::pageSize();
+	const size_t bytes = std::max(chunk_bytes/page, size_t(1))*page;
+	return std::max(bytes/sizeof(T), size_t(1));
+}
+
+}
+
+// Zero copy buffer over a file mapping, created with CL_MEM_USE_HOST_PTR.
+// On CPU devices and others with unified memory (DeviceInfo) kernels read
+// the mapped pages directly; elsewhere the runtime copies on first use,
+// in which case streamFile into an ordinary buffer is usually faster.
+// The buffer has to stay alive until all commands using it completed.
+template<class T>
+class FileBuffer : private detail::MappedFileHolder, public Buffer<T> {
+public:
+	// maps an existing file, changes made through the buffer stay private
+	FileBuffer(const Context &c, const std::string &path, cl_mem_flags flags = CL_MEM_READ_WRITE)
+		: MappedFileHolder(path), Buffer<T>(c, detail::elementCount<T>(file), flags | CL_MEM_USE_HOST_PTR, file.data())
+	{
+	}
+
+	// Creates a file at path holding s elements. Mapping the buffer (map().wait())
+	// makes the runtime bring the device contents into the file.
+	FileBuffer(const Context &c, size_t s, const std::string &path, cl_mem_flags flags = CL_MEM_READ_WRITE)
+		: MappedFileHolder(path, s*sizeof(T)), Buffer<T>(c, s, flags | CL_MEM_USE_HOST_PTR, file.data())
+	{
+	}
+
+	MappedFile& getFile() { return file; }
+};
+
+// Copies a mapped file into buffer in chunks of about chunk_bytes, with up
+// to depth writes in flight. The next chunk is read ahead from disk while
+// earlier ones are transferred. Returns when all writes completed.
+template<class T>
+void streamFile(const MappedFile &file, Buffer<T> &buffer, size_t chunk_bytes = 16 << 20, size_t depth = 4)
+{
+	const size_t count = detail::elementCount<T>(file);
+	if(count > buffer.size())
+		throw std::runtime_error("buffer too short");
+	const size_t chunk = detail::chunkLength<T>(chunk_bytes);
+	const T *source = static_cast<const T*>(file.data());
+	detail::Transfers transfers(depth);
+	for(size_t offset = 0;offset<count;offset += chunk)
+	{
+		const size_t length = std::min(chunk, count - offset);
+		file.prefetch((offset + length)*sizeof(T), chunk*sizeof(T));
+		transfers.reserve();
+		transfers.push(buffer.writeRange(offset, length, source + offset));
+	}
+	transfers.finish();
+}
+
+template<class T>
+void streamFile(const std::string &path, Buffer<T> &buffer, size_t chunk_bytes = 16 << 20, size_t depth = 4)
+{
+	MappedFile file(path);
+	streamFile(file, buffer, chunk_bytes, depth);
+}
+
+// The reverse path: writes the contents of buffer to a new file at path
+// with chunked reads straight into the file mapping. An empty buffer
+// throws without creating the file.
+template<class T>
+void dumpFile(Buffer<T> &buffer, const std::string &path, size_t chunk_bytes = 16 << 20, size_t depth = 4)
+{
+	const size_t count = buffer.size();
+	MappedFile file(path, count*sizeof(T));
+	const size_t chunk = detail::chunkLength<T>(chunk_bytes);
+	T *destination = static_cast<T*>(file.data());
+	detail::Transfers transfers(depth);
+	for(size_t offset = 0;offset<count;offset += chunk)
+	{
+		transfers.reserve();
+		transfers.push(buffer.readRange(offset, std::min(chunk, count - offset), destination + offset));
+	}
+	transfers.finish();
+}
+
+}
+
+#endif
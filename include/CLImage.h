@@ -1,11 +1,43 @@
 #ifndef CL_IMAGE_H
 #define CL_IMAGE_H
 
+#include <cstring>
+
 #include "CLEvent.h"
 #include "CLContext.h"
+#include "CLBuffer.h"
+#include "CLStorage.h"
 
 namespace clp {
 
+template<class T>
+inline cl_image_format defaultImageFormat()
+{
+	cl_image_format format;
+	format.image_channel_data_type = type2format<T>::type;
+	format.image_channel_order = type2format<T>::order;
+	return format;
+}
+
+// pitches are in bytes here, as expected by clCreateImage
+inline cl_mem createImage(const Context &context, const cl_image_format &format, cl_mem_object_type type,
+	size_t width, size_t height, size_t depth, size_t array_size, size_t row_pitch = 0, cl_mem buffer = 0)
+{
+	cl_image_desc desc;
+	std::memset(&desc, 0, sizeof(desc));
+	desc.image_type = type;
+	desc.image_width = width;
+	desc.image_height = height;
+	desc.image_depth = depth;
+	desc.image_array_size = array_size;
+	desc.image_row_pitch = row_pitch;
+	desc.buffer = buffer;
+	cl_int error;
+	cl_mem image = clCreateImage(context.getContext(), CL_MEM_READ_WRITE, &format, &desc, 0, &error);
+	checkError(error);
+	return image;
+}
+
 template<class T>
 class Image2D {
 public:
@@ -18,14 +50,37 @@ public:
     typedef size_t size_type;
 
 	Image2D(const Context &c, size_t width, size_t height)
-		: host_ptr(0), width_(width), height_(height), context(c)
+		: host_ptr(0), width_(width), height_(height), pinned(0), context(c)
 	{
-        cl_image_format format;
-        format.image_channel_data_type = type2format<T>::type;
-		format.image_channel_order = type2format<T>::order;
-		cl_int error;
-		buffer = clCreateImage2D(context.getContext(), CL_MEM_READ_WRITE, &format, width_, height_, 0, 0, &error);
-		checkError(error);
+		buffer = createImage(context, defaultImageFormat<T>(), CL_MEM_OBJECT_IMAGE2D, width_, height_, 0, 0);
+	}
+
+	Image2D(const Context &c, size_t width, size_t height, const cl_image_format &format)
+		: host_ptr(0), width_(width), height_(height), pinned(0), context(c)
+	{
+		buffer = createImage(context, format, CL_MEM_OBJECT_IMAGE2D, width_, height_, 0, 0);
+	}
+
+	// Aliases the storage of an existing buffer without copying. row_pitch
+	// is given in elements and has to respect CL_DEVICE_IMAGE_PITCH_ALIGNMENT.
+	// Needs OpenCL 2.0 or cl_khr_image2d_from_buffer.
+	Image2D(const Context &c, Buffer<T> &source, size_t width, size_t height, size_t row_pitch = 0)
+		: host_ptr(0), width_(width), height_(height), pinned(0), context(c)
+	{
+		if(row_pitch == 0)
+			row_pitch = width_;
+		if(row_pitch < width_ || row_pitch*height_ > source.size())
+			throw std::runtime_error("buffer too short");
+		pinned = source.pin();
+		try
+		{
+			buffer = createImage(context, defaultImageFormat<T>(), CL_MEM_OBJECT_IMAGE2D, width_, height_, 0, 0, row_pitch*sizeof(value_type), *source.getMem());
+		}
+		catch(...)
+		{
+			unpin();
+			throw;
+		}
 	}
 
 	Event map(cl_map_flags flags = CL_MAP_READ | CL_MAP_WRITE)
@@ -40,6 +95,7 @@ public:
 	
 	Event map(cl_map_flags flags, cl_uint event_count, const cl_event *events)
 	{
+		CLP_TRACE_SCOPE("Image2D::map");
 		check_unmapped();
 		cl_int error;
 		cl_event e;
@@ -47,6 +103,7 @@ public:
         const size_t region[] = {width_, height_, 1};
 		host_ptr = static_cast<value_type*>(clEnqueueMapImage(context.getQueue(), buffer, CL_FALSE, flags, origin, region, &image_row_pitch, &image_slice_pitch, event_count, events, &e, &error));
 		checkError(error);
+		CLP_TRACE_DEVICE(context.getQueue(), e, event_count, events, region[0]*region[1]*region[2]*sizeof(value_type));
         image_row_pitch /= sizeof(value_type);
 		event = Event(e);
 		return event;
@@ -64,11 +121,86 @@ public:
 	
 	Event unmap(cl_uint event_count, const cl_event *events)
 	{
+		CLP_TRACE_SCOPE("Image2D::unmap");
 		check_mapped();
 		cl_event e;
 		cl_int error = clEnqueueUnmapMemObject(context.getQueue(), buffer, host_ptr, event_count, events, &e);
 		host_ptr = 0;
 		checkError(error);
+		CLP_TRACE_DEVICE(context.getQueue(), e, event_count, events, width_*height_*sizeof(value_type));
+		event = Event(e);
+		return event;
+	}
+
+	// row_pitch is given in elements, 0 means tightly packed rows
+	Event read(value_type *destination, size_t row_pitch = 0)
+	{
+		return readRegion(0, 0, width_, height_, destination, row_pitch, 0, 0);
+	}
+
+	Event read(value_type *destination, size_t row_pitch, const Event &event)
+	{
+		return readRegion(0, 0, width_, height_, destination, row_pitch, 1, event.getEventPtr());
+	}
+
+	Event readRegion(size_t x, size_t y, size_t w, size_t h, value_type *destination, size_t row_pitch = 0)
+	{
+		return readRegion(x, y, w, h, destination, row_pitch, 0, 0);
+	}
+
+	Event readRegion(size_t x, size_t y, size_t w, size_t h, value_type *destination, size_t row_pitch, const Event &event)
+	{
+		return readRegion(x, y, w, h, destination, row_pitch, 1, event.getEventPtr());
+	}
+
+	Event readRegion(size_t x, size_t y, size_t w, size_t h, value_type *destination, size_t row_pitch, cl_uint event_count, const cl_event *events)
+	{
+		CLP_TRACE_SCOPE("Image2D::readRegion");
+		if(x+w>width_ || y+h>height_)
+			throw std::runtime_error("region outside of image");
+		check_unmapped();
+		cl_event e;
+		const size_t origin[] = {x, y, 0};
+		const size_t region[] = {w, h, 1};
+		cl_int error = clEnqueueReadImage(context.getQueue(), buffer, CL_FALSE, origin, region, row_pitch*sizeof(value_type), 0, destination, event_count, events, &e);
+		checkError(error);
+		CLP_TRACE_DEVICE(context.getQueue(), e, event_count, events, region[0]*region[1]*region[2]*sizeof(value_type));
+		event = Event(e);
+		return event;
+	}
+
+	Event write(const value_type *source, size_t row_pitch = 0)
+	{
+		return writeRegion(0, 0, width_, height_, source, row_pitch, 0, 0);
+	}
+
+	Event write(const value_type *source, size_t row_pitch, const Event &event)
+	{
+		return writeRegion(0, 0, width_, height_, source, row_pitch, 1, event.getEventPtr());
+	}
+
+	Event writeRegion(size_t x, size_t y, size_t w, size_t h, const value_type *source, size_t row_pitch = 0)
+	{
+		return writeRegion(x, y, w, h, source, row_pitch, 0, 0);
+	}
+
+	Event writeRegion(size_t x, size_t y, size_t w, size_t h, const value_type *source, size_t row_pitch, const Event &event)
+	{
+		return writeRegion(x, y, w, h, source, row_pitch, 1, event.getEventPtr());
+	}
+
+	Event writeRegion(size_t x, size_t y, size_t w, size_t h, const value_type *source, size_t row_pitch, cl_uint event_count, const cl_event *events)
+	{
+		CLP_TRACE_SCOPE("Image2D::writeRegion");
+		if(x+w>width_ || y+h>height_)
+			throw std::runtime_error("region outside of image");
+		check_unmapped();
+		cl_event e;
+		const size_t origin[] = {x, y, 0};
+		const size_t region[] = {w, h, 1};
+		cl_int error = clEnqueueWriteImage(context.getQueue(), buffer, CL_FALSE, origin, region, row_pitch*sizeof(value_type), 0, source, event_count, events, &e);
+		checkError(error);
+		CLP_TRACE_DEVICE(context.getQueue(), e, event_count, events, region[0]*region[1]*region[2]*sizeof(value_type));
 		event = Event(e);
 		return event;
 	}
@@ -100,6 +232,7 @@ public:
 	~Image2D()
 	{
 		clReleaseMemObject(buffer);
+		unpin();
 	}
 private:
 	Image2D(const Image2D&) { }
@@ -116,12 +249,20 @@ private:
         if(host_ptr)
             throw std::runtime_error("Image mapped");
     }
+
+	void unpin()
+	{
+		if(pinned)
+			context.getResidency()->unpin(pinned);
+	}
     
 	value_type *host_ptr;
 	size_t width_, height_;
     size_t image_row_pitch, image_slice_pitch;
 	cl_mem buffer;
 	Event event;
+	// the buffer entry kept on the device while the image aliases it
+	Residency::Entry *pinned;
 	Context context;
 };
 
@@ -141,12 +282,13 @@ public:
 	Image3D(const Context &c, size_t width, size_t height, size_t depth)
 		: host_ptr(0), width_(width), height_(height), depth_(depth), context(c)
 	{
-        cl_image_format format;
-        format.image_channel_data_type = type2format<T>::type;
-		format.image_channel_order = type2format<T>::order;
-		cl_int error;
-		buffer = clCreateImage3D(context.getContext(), CL_MEM_READ_WRITE, &format, width_, height_, depth_, 0, 0, 0, &error);
-		checkError(error);
+		buffer = createImage(context, defaultImageFormat<T>(), CL_MEM_OBJECT_IMAGE3D, width_, height_, depth_, 0);
+	}
+
+	Image3D(const Context &c, size_t width, size_t height, size_t depth, const cl_image_format &format)
+		: host_ptr(0), width_(width), height_(height), depth_(depth), context(c)
+	{
+		buffer = createImage(context, format, CL_MEM_OBJECT_IMAGE3D, width_, height_, depth_, 0);
 	}
 
 	Event map(cl_map_flags flags = CL_MAP_READ | CL_MAP_WRITE)
@@ -161,6 +303,7 @@ public:
 	
 	Event map(cl_map_flags flags, cl_uint event_count, const cl_event *events)
 	{
+		CLP_TRACE_SCOPE("Image3D::map");
 		check_unmapped();
 		cl_int error;
 		cl_event e;
@@ -168,6 +311,7 @@ public:
         const size_t region[] = {width_, height_, depth_};
 		host_ptr = static_cast<value_type*>(clEnqueueMapImage(context.getQueue(), buffer, CL_FALSE, flags, origin, region, &image_row_pitch, &image_slice_pitch, event_count, events, &e, &error));
 		checkError(error);
+		CLP_TRACE_DEVICE(context.getQueue(), e, event_count, events, region[0]*region[1]*region[2]*sizeof(value_type));
         image_row_pitch /= sizeof(value_type);
 		image_slice_pitch /= sizeof(value_type);
 		event = Event(e);
@@ -186,11 +330,62 @@ public:
 	
 	Event unmap(cl_uint event_count, const cl_event *events)
 	{
+		CLP_TRACE_SCOPE("Image3D::unmap");
 		check_mapped();
 		cl_event e;
 		cl_int error = clEnqueueUnmapMemObject(context.getQueue(), buffer, host_ptr, event_count, events, &e);
 		host_ptr = 0;
 		checkError(error);
+		CLP_TRACE_DEVICE(context.getQueue(), e, event_count, events, width_*height_*depth_*sizeof(value_type));
+		event = Event(e);
+		return event;
+	}
+
+	// pitches are given in elements, 0 means tightly packed
+	Event read(value_type *destination, size_t row_pitch = 0, size_t slice_pitch = 0)
+	{
+		return read(destination, row_pitch, slice_pitch, 0, 0);
+	}
+
+	Event read(value_type *destination, size_t row_pitch, size_t slice_pitch, const Event &event)
+	{
+		return read(destination, row_pitch, slice_pitch, 1, event.getEventPtr());
+	}
+
+	Event read(value_type *destination, size_t row_pitch, size_t slice_pitch, cl_uint event_count, const cl_event *events)
+	{
+		CLP_TRACE_SCOPE("Image3D::read");
+		check_unmapped();
+		cl_event e;
+		const size_t origin[] = {0, 0, 0};
+		const size_t region[] = {width_, height_, depth_};
+		cl_int error = clEnqueueReadImage(context.getQueue(), buffer, CL_FALSE, origin, region, row_pitch*sizeof(value_type), slice_pitch*sizeof(value_type), destination, event_count, events, &e);
+		checkError(error);
+		CLP_TRACE_DEVICE(context.getQueue(), e, event_count, events, region[0]*region[1]*region[2]*sizeof(value_type));
+		event = Event(e);
+		return event;
+	}
+
+	Event write(const value_type *source, size_t row_pitch = 0, size_t slice_pitch = 0)
+	{
+		return write(source, row_pitch, slice_pitch, 0, 0);
+	}
+
+	Event write(const value_type *source, size_t row_pitch, size_t slice_pitch, const Event &event)
+	{
+		return write(source, row_pitch, slice_pitch, 1, event.getEventPtr());
+	}
+
+	Event write(const value_type *source, size_t row_pitch, size_t slice_pitch, cl_uint event_count, const cl_event *events)
+	{
+		CLP_TRACE_SCOPE("Image3D::write");
+		check_unmapped();
+		cl_event e;
+		const size_t origin[] = {0, 0, 0};
+		const size_t region[] = {width_, height_, depth_};
+		cl_int error = clEnqueueWriteImage(context.getQueue(), buffer, CL_FALSE, origin, region, row_pitch*sizeof(value_type), slice_pitch*sizeof(value_type), source, event_count, events, &e);
+		checkError(error);
+		CLP_TRACE_DEVICE(context.getQueue(), e, event_count, events, region[0]*region[1]*region[2]*sizeof(value_type));
 		event = Event(e);
 		return event;
 	}
@@ -249,6 +444,549 @@ private:
 	Context context;
 };
 
+
+template<class T>
+class Image1D {
+public:
+	typedef T value_type;
+	typedef T& reference;
+	typedef const T& const_reference;
+	typedef T* iterator;
+	typedef const T* const_iterator;
+	typedef const ptrdiff_t difference_type;
+	typedef size_t size_type;
+
+	Image1D(const Context &c, size_t width)
+		: host_ptr(0), width_(width), context(c)
+	{
+		buffer = createImage(context, defaultImageFormat<T>(), CL_MEM_OBJECT_IMAGE1D, width_, 0, 0, 0);
+	}
+
+	Image1D(const Context &c, size_t width, const cl_image_format &format)
+		: host_ptr(0), width_(width), context(c)
+	{
+		buffer = createImage(context, format, CL_MEM_OBJECT_IMAGE1D, width_, 0, 0, 0);
+	}
+
+	Event map(cl_map_flags flags = CL_MAP_READ | CL_MAP_WRITE)
+	{
+		return map(flags, 0, 0);
+	}
+
+	Event map(cl_map_flags flags, const Event &event)
+	{
+		return map(flags, 1, event.getEventPtr());
+	}
+
+	Event map(cl_map_flags flags, cl_uint event_count, const cl_event *events)
+	{
+		CLP_TRACE_SCOPE("Image1D::map");
+		check_unmapped();
+		cl_int error;
+		cl_event e;
+		const size_t origin[] = {0, 0, 0};
+		const size_t region[] = {width_, 1, 1};
+		host_ptr = static_cast<value_type*>(clEnqueueMapImage(context.getQueue(), buffer, CL_FALSE, flags, origin, region, &image_row_pitch, &image_slice_pitch, event_count, events, &e, &error));
+		checkError(error);
+		CLP_TRACE_DEVICE(context.getQueue(), e, event_count, events, region[0]*region[1]*region[2]*sizeof(value_type));
+		event = Event(e);
+		return event;
+	}
+
+	Event unmap()
+	{
+		return unmap(0, 0);
+	}
+
+	Event unmap(const Event &event)
+	{
+		return unmap(1, event.getEventPtr());
+	}
+
+	Event unmap(cl_uint event_count, const cl_event *events)
+	{
+		CLP_TRACE_SCOPE("Image1D::unmap");
+		check_mapped();
+		cl_event e;
+		cl_int error = clEnqueueUnmapMemObject(context.getQueue(), buffer, host_ptr, event_count, events, &e);
+		host_ptr = 0;
+		checkError(error);
+		CLP_TRACE_DEVICE(context.getQueue(), e, event_count, events, width_*sizeof(value_type));
+		event = Event(e);
+		return event;
+	}
+
+	Event read(value_type *destination)
+	{
+		return read(destination, 0, 0);
+	}
+
+	Event read(value_type *destination, const Event &event)
+	{
+		return read(destination, 1, event.getEventPtr());
+	}
+
+	Event read(value_type *destination, cl_uint event_count, const cl_event *events)
+	{
+		CLP_TRACE_SCOPE("Image1D::read");
+		check_unmapped();
+		cl_event e;
+		const size_t origin[] = {0, 0, 0};
+		const size_t region[] = {width_, 1, 1};
+		cl_int error = clEnqueueReadImage(context.getQueue(), buffer, CL_FALSE, origin, region, 0, 0, destination, event_count, events, &e);
+		checkError(error);
+		CLP_TRACE_DEVICE(context.getQueue(), e, event_count, events, region[0]*region[1]*region[2]*sizeof(value_type));
+		event = Event(e);
+		return event;
+	}
+
+	Event write(const value_type *source)
+	{
+		return write(source, 0, 0);
+	}
+
+	Event write(const value_type *source, const Event &event)
+	{
+		return write(source, 1, event.getEventPtr());
+	}
+
+	Event write(const value_type *source, cl_uint event_count, const cl_event *events)
+	{
+		CLP_TRACE_SCOPE("Image1D::write");
+		check_unmapped();
+		cl_event e;
+		const size_t origin[] = {0, 0, 0};
+		const size_t region[] = {width_, 1, 1};
+		cl_int error = clEnqueueWriteImage(context.getQueue(), buffer, CL_FALSE, origin, region, 0, 0, source, event_count, events, &e);
+		checkError(error);
+		CLP_TRACE_DEVICE(context.getQueue(), e, event_count, events, region[0]*region[1]*region[2]*sizeof(value_type));
+		event = Event(e);
+		return event;
+	}
+
+	inline reference operator[](size_t i)
+	{
+		check_mapped();
+		return host_ptr[i];
+	}
+
+	inline const_reference operator[](size_t i) const
+	{
+		check_mapped();
+		return host_ptr[i];
+	}
+
+	inline value_type* data() { check_mapped(); return host_ptr; }
+	inline const value_type* data() const { check_mapped(); return host_ptr; }
+	inline iterator begin() { check_mapped(); return host_ptr; }
+	inline const_iterator begin() const { check_mapped(); return host_ptr; }
+	inline iterator end() { check_mapped(); return host_ptr+width_; }
+	inline const_iterator end() const { check_mapped(); return host_ptr+width_; }
+
+	inline size_type width() const { return width_; }
+	inline size_type size() const { return width_; }
+
+	const cl_mem* getMem() const { return &buffer; }
+	Event getLastEvent() { return event; }
+
+	bool isMapped() const { return host_ptr != 0; }
+
+	~Image1D()
+	{
+		clReleaseMemObject(buffer);
+	}
+private:
+	Image1D(const Image1D&) { }
+	Image1D& operator=(const Image1D&) { return *this; }
+
+	inline void check_mapped() const
+	{
+		if(!host_ptr)
+			throw std::runtime_error("Image not mapped");
+	}
+
+	inline void check_unmapped() const
+	{
+		if(host_ptr)
+			throw std::runtime_error("Image mapped");
+	}
+
+	value_type *host_ptr;
+	size_t width_;
+	size_t image_row_pitch, image_slice_pitch;
+	cl_mem buffer;
+	Event event;
+	Context context;
+};
+
+
+template<class T>
+class Image1DBuffer {
+public:
+	typedef T value_type;
+	typedef T& reference;
+	typedef const T& const_reference;
+	typedef T* iterator;
+	typedef const T* const_iterator;
+	typedef const ptrdiff_t difference_type;
+	typedef size_t size_type;
+
+	// Aliases the storage of an existing buffer without copying, width
+	// defaults to the whole buffer and is limited by CL_DEVICE_IMAGE_MAX_BUFFER_SIZE.
+	Image1DBuffer(const Context &c, Buffer<T> &source, size_t width = 0)
+		: host_ptr(0), width_(width ? width : source.size()), pinned(0), context(c)
+	{
+		if(width_ > source.size())
+			throw std::runtime_error("buffer too short");
+		pinned = source.pin();
+		try
+		{
+			buffer = createImage(context, defaultImageFormat<T>(), CL_MEM_OBJECT_IMAGE1D_BUFFER, width_, 0, 0, 0, 0, *source.getMem());
+		}
+		catch(...)
+		{
+			unpin();
+			throw;
+		}
+	}
+
+	Event map(cl_map_flags flags = CL_MAP_READ | CL_MAP_WRITE)
+	{
+		return map(flags, 0, 0);
+	}
+
+	Event map(cl_map_flags flags, const Event &event)
+	{
+		return map(flags, 1, event.getEventPtr());
+	}
+
+	Event map(cl_map_flags flags, cl_uint event_count, const cl_event *events)
+	{
+		CLP_TRACE_SCOPE("Image1DBuffer::map");
+		check_unmapped();
+		cl_int error;
+		cl_event e;
+		const size_t origin[] = {0, 0, 0};
+		const size_t region[] = {width_, 1, 1};
+		host_ptr = static_cast<value_type*>(clEnqueueMapImage(context.getQueue(), buffer, CL_FALSE, flags, origin, region, &image_row_pitch, &image_slice_pitch, event_count, events, &e, &error));
+		checkError(error);
+		CLP_TRACE_DEVICE(context.getQueue(), e, event_count, events, region[0]*region[1]*region[2]*sizeof(value_type));
+		event = Event(e);
+		return event;
+	}
+
+	Event unmap()
+	{
+		return unmap(0, 0);
+	}
+
+	Event unmap(const Event &event)
+	{
+		return unmap(1, event.getEventPtr());
+	}
+
+	Event unmap(cl_uint event_count, const cl_event *events)
+	{
+		CLP_TRACE_SCOPE("Image1DBuffer::unmap");
+		check_mapped();
+		cl_event e;
+		cl_int error = clEnqueueUnmapMemObject(context.getQueue(), buffer, host_ptr, event_count, events, &e);
+		host_ptr = 0;
+		checkError(error);
+		CLP_TRACE_DEVICE(context.getQueue(), e, event_count, events, width_*sizeof(value_type));
+		event = Event(e);
+		return event;
+	}
+
+	Event read(value_type *destination)
+	{
+		return read(destination, 0, 0);
+	}
+
+	Event read(value_type *destination, const Event &event)
+	{
+		return read(destination, 1, event.getEventPtr());
+	}
+
+	Event read(value_type *destination, cl_uint event_count, const cl_event *events)
+	{
+		CLP_TRACE_SCOPE("Image1DBuffer::read");
+		check_unmapped();
+		cl_event e;
+		const size_t origin[] = {0, 0, 0};
+		const size_t region[] = {width_, 1, 1};
+		cl_int error = clEnqueueReadImage(context.getQueue(), buffer, CL_FALSE, origin, region, 0, 0, destination, event_count, events, &e);
+		checkError(error);
+		CLP_TRACE_DEVICE(context.getQueue(), e, event_count, events, region[0]*region[1]*region[2]*sizeof(value_type));
+		event = Event(e);
+		return event;
+	}
+
+	Event write(const value_type *source)
+	{
+		return write(source, 0, 0);
+	}
+
+	Event write(const value_type *source, const Event &event)
+	{
+		return write(source, 1, event.getEventPtr());
+	}
+
+	Event write(const value_type *source, cl_uint event_count, const cl_event *events)
+	{
+		CLP_TRACE_SCOPE("Image1DBuffer::write");
+		check_unmapped();
+		cl_event e;
+		const size_t origin[] = {0, 0, 0};
+		const size_t region[] = {width_, 1, 1};
+		cl_int error = clEnqueueWriteImage(context.getQueue(), buffer, CL_FALSE, origin, region, 0, 0, source, event_count, events, &e);
+		checkError(error);
+		CLP_TRACE_DEVICE(context.getQueue(), e, event_count, events, region[0]*region[1]*region[2]*sizeof(value_type));
+		event = Event(e);
+		return event;
+	}
+
+	inline reference operator[](size_t i)
+	{
+		check_mapped();
+		return host_ptr[i];
+	}
+
+	inline const_reference operator[](size_t i) const
+	{
+		check_mapped();
+		return host_ptr[i];
+	}
+
+	inline value_type* data() { check_mapped(); return host_ptr; }
+	inline const value_type* data() const { check_mapped(); return host_ptr; }
+	inline iterator begin() { check_mapped(); return host_ptr; }
+	inline const_iterator begin() const { check_mapped(); return host_ptr; }
+	inline iterator end() { check_mapped(); return host_ptr+width_; }
+	inline const_iterator end() const { check_mapped(); return host_ptr+width_; }
+
+	inline size_type width() const { return width_; }
+	inline size_type size() const { return width_; }
+
+	const cl_mem* getMem() const { return &buffer; }
+	Event getLastEvent() { return event; }
+
+	bool isMapped() const { return host_ptr != 0; }
+
+	~Image1DBuffer()
+	{
+		clReleaseMemObject(buffer);
+		unpin();
+	}
+private:
+	Image1DBuffer(const Image1DBuffer&) { }
+	Image1DBuffer& operator=(const Image1DBuffer&) { return *this; }
+
+	inline void check_mapped() const
+	{
+		if(!host_ptr)
+			throw std::runtime_error("Image not mapped");
+	}
+
+	inline void check_unmapped() const
+	{
+		if(host_ptr)
+			throw std::runtime_error("Image mapped");
+	}
+
+	void unpin()
+	{
+		if(pinned)
+			context.getResidency()->unpin(pinned);
+	}
+
+	value_type *host_ptr;
+	size_t width_;
+	size_t image_row_pitch, image_slice_pitch;
+	cl_mem buffer;
+	Event event;
+	// the buffer entry kept on the device while the image aliases it
+	Residency::Entry *pinned;
+	Context context;
+};
+
+
+template<class T>
+class Image2DArray {
+public:
+	typedef T value_type;
+	typedef T& reference;
+	typedef const T& const_reference;
+	typedef T* iterator;
+	typedef const T* const_iterator;
+	typedef const ptrdiff_t difference_type;
+	typedef size_t size_type;
+
+	Image2DArray(const Context &c, size_t width, size_t height, size_t layers)
+		: host_ptr(0), width_(width), height_(height), layers_(layers), context(c)
+	{
+		buffer = createImage(context, defaultImageFormat<T>(), CL_MEM_OBJECT_IMAGE2D_ARRAY, width_, height_, 0, layers_);
+	}
+
+	Image2DArray(const Context &c, size_t width, size_t height, size_t layers, const cl_image_format &format)
+		: host_ptr(0), width_(width), height_(height), layers_(layers), context(c)
+	{
+		buffer = createImage(context, format, CL_MEM_OBJECT_IMAGE2D_ARRAY, width_, height_, 0, layers_);
+	}
+
+	Event map(cl_map_flags flags = CL_MAP_READ | CL_MAP_WRITE)
+	{
+		return map(flags, 0, 0);
+	}
+
+	Event map(cl_map_flags flags, const Event &event)
+	{
+		return map(flags, 1, event.getEventPtr());
+	}
+
+	Event map(cl_map_flags flags, cl_uint event_count, const cl_event *events)
+	{
+		CLP_TRACE_SCOPE("Image2DArray::map");
+		check_unmapped();
+		cl_int error;
+		cl_event e;
+		const size_t origin[] = {0, 0, 0};
+		const size_t region[] = {width_, height_, layers_};
+		host_ptr = static_cast<value_type*>(clEnqueueMapImage(context.getQueue(), buffer, CL_FALSE, flags, origin, region, &image_row_pitch, &image_slice_pitch, event_count, events, &e, &error));
+		checkError(error);
+		CLP_TRACE_DEVICE(context.getQueue(), e, event_count, events, region[0]*region[1]*region[2]*sizeof(value_type));
+		image_row_pitch /= sizeof(value_type);
+		image_slice_pitch /= sizeof(value_type);
+		event = Event(e);
+		return event;
+	}
+
+	Event unmap()
+	{
+		return unmap(0, 0);
+	}
+
+	Event unmap(const Event &event)
+	{
+		return unmap(1, event.getEventPtr());
+	}
+
+	Event unmap(cl_uint event_count, const cl_event *events)
+	{
+		CLP_TRACE_SCOPE("Image2DArray::unmap");
+		check_mapped();
+		cl_event e;
+		cl_int error = clEnqueueUnmapMemObject(context.getQueue(), buffer, host_ptr, event_count, events, &e);
+		host_ptr = 0;
+		checkError(error);
+		CLP_TRACE_DEVICE(context.getQueue(), e, event_count, events, width_*height_*layers_*sizeof(value_type));
+		event = Event(e);
+		return event;
+	}
+
+	// pitches are given in elements, 0 means tightly packed
+	Event read(value_type *destination, size_t row_pitch = 0, size_t slice_pitch = 0)
+	{
+		return read(destination, row_pitch, slice_pitch, 0, 0);
+	}
+
+	Event read(value_type *destination, size_t row_pitch, size_t slice_pitch, const Event &event)
+	{
+		return read(destination, row_pitch, slice_pitch, 1, event.getEventPtr());
+	}
+
+	Event read(value_type *destination, size_t row_pitch, size_t slice_pitch, cl_uint event_count, const cl_event *events)
+	{
+		CLP_TRACE_SCOPE("Image2DArray::read");
+		check_unmapped();
+		cl_event e;
+		const size_t origin[] = {0, 0, 0};
+		const size_t region[] = {width_, height_, layers_};
+		cl_int error = clEnqueueReadImage(context.getQueue(), buffer, CL_FALSE, origin, region, row_pitch*sizeof(value_type), slice_pitch*sizeof(value_type), destination, event_count, events, &e);
+		checkError(error);
+		CLP_TRACE_DEVICE(context.getQueue(), e, event_count, events, region[0]*region[1]*region[2]*sizeof(value_type));
+		event = Event(e);
+		return event;
+	}
+
+	Event write(const value_type *source, size_t row_pitch = 0, size_t slice_pitch = 0)
+	{
+		return write(source, row_pitch, slice_pitch, 0, 0);
+	}
+
+	Event write(const value_type *source, size_t row_pitch, size_t slice_pitch, const Event &event)
+	{
+		return write(source, row_pitch, slice_pitch, 1, event.getEventPtr());
+	}
+
+	Event write(const value_type *source, size_t row_pitch, size_t slice_pitch, cl_uint event_count, const cl_event *events)
+	{
+		CLP_TRACE_SCOPE("Image2DArray::write");
+		check_unmapped();
+		cl_event e;
+		const size_t origin[] = {0, 0, 0};
+		const size_t region[] = {width_, height_, layers_};
+		cl_int error = clEnqueueWriteImage(context.getQueue(), buffer, CL_FALSE, origin, region, row_pitch*sizeof(value_type), slice_pitch*sizeof(value_type), source, event_count, events, &e);
+		checkError(error);
+		CLP_TRACE_DEVICE(context.getQueue(), e, event_count, events, region[0]*region[1]*region[2]*sizeof(value_type));
+		event = Event(e);
+		return event;
+	}
+
+	inline reference operator()(size_t i, size_t j, size_t layer)
+	{
+		check_mapped();
+		return host_ptr[layer*image_slice_pitch + j*image_row_pitch + i];
+	}
+
+	inline const_reference operator()(size_t i, size_t j, size_t layer) const
+	{
+		check_mapped();
+		return host_ptr[layer*image_slice_pitch + j*image_row_pitch + i];
+	}
+
+	inline value_type* data() { check_mapped(); return host_ptr; }
+	inline const value_type* data() const { check_mapped(); return host_ptr; }
+	inline size_type row_pitch() const { return image_row_pitch; }
+	inline size_type slice_pitch() const { return image_slice_pitch; }
+
+	inline size_type width() const { return width_; }
+	inline size_type height() const { return height_; }
+	inline size_type layers() const { return layers_; }
+
+	const cl_mem* getMem() const { return &buffer; }
+	Event getLastEvent() { return event; }
+
+	bool isMapped() const { return host_ptr != 0; }
+
+	~Image2DArray()
+	{
+		clReleaseMemObject(buffer);
+	}
+private:
+	Image2DArray(const Image2DArray&) { }
+	Image2DArray& operator=(const Image2DArray&) { return *this; }
+
+	inline void check_mapped() const
+	{
+		if(!host_ptr)
+			throw std::runtime_error("Image not mapped");
+	}
+
+	inline void check_unmapped() const
+	{
+		if(host_ptr)
+			throw std::runtime_error("Image mapped");
+	}
+
+	value_type *host_ptr;
+	size_t width_, height_, layers_;
+	size_t image_row_pitch, image_slice_pitch;
+	cl_mem buffer;
+	Event event;
+	Context context;
+};
+
 }
 
 #endif
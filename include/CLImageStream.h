@@ -0,0 +1,176 @@
+#ifndef CL_IMAGESTREAM_H
+#define CL_IMAGESTREAM_H
+
+#include <algorithm>
+#include <vector>
+
+#include "CLEvent.h"
+#include "CLContext.h"
+#include "CLImage.h"
+
+namespace clp {
+
+// Converters turn one host frame into the element layout of the target
+// image. Pitches are given in elements of source_type and target_type.
+// The loops are kept branch free so the compiler can vectorize them.
+
+template<class T>
+struct Passthrough {
+	typedef T source_type;
+	typedef T target_type;
+
+	static size_t sourcePitch(size_t width) { return width; }
+
+	static void convert(const T *source, size_t source_pitch, T *target, size_t target_pitch, size_t width, size_t height)
+	{
+		for(size_t j = 0;j<height;++j)
+			std::copy(source + j*source_pitch, source + j*source_pitch + width, target + j*target_pitch);
+	}
+};
+
+// packed 24bit BGR to RGBA with opaque alpha
+struct PackedBGR8 {
+	typedef cl_uchar source_type;
+	typedef cl_uchar4 target_type;
+
+	static size_t sourcePitch(size_t width) { return 3*width; }
+
+	static void convert(const cl_uchar *source, size_t source_pitch, cl_uchar4 *target, size_t target_pitch, size_t width, size_t height)
+	{
+		for(size_t j = 0;j<height;++j)
+		{
+			const cl_uchar *s = source + j*source_pitch;
+			cl_uchar *t = reinterpret_cast<cl_uchar*>(target + j*target_pitch);
+			for(size_t i = 0;i<width;++i)
+			{
+				t[4*i+0] = s[3*i+2];
+				t[4*i+1] = s[3*i+1];
+				t[4*i+2] = s[3*i+0];
+				t[4*i+3] = 255;
+			}
+		}
+	}
+};
+
+// planar I420 (full resolution Y followed by half resolution U and V planes)
+// to RGBA using BT.601 limited range coefficients
+struct PlanarYUV420 {
+	typedef cl_uchar source_type;
+	typedef cl_uchar4 target_type;
+
+	static size_t sourcePitch(size_t width) { return width; }
+
+	static void convert(const cl_uchar *source, size_t source_pitch, cl_uchar4 *target, size_t target_pitch, size_t width, size_t height)
+	{
+		if(width%2 != 0 || height%2 != 0)
+			throw std::runtime_error("YUV420 frames need even dimensions");
+		const size_t chroma_pitch = source_pitch/2;
+		const cl_uchar *uplane = source + source_pitch*height;
+		const cl_uchar *vplane = uplane + chroma_pitch*(height/2);
+		for(size_t j = 0;j<height;++j)
+		{
+			const cl_uchar *y = source + j*source_pitch;
+			const cl_uchar *u = uplane + (j/2)*chroma_pitch;
+			const cl_uchar *v = vplane + (j/2)*chroma_pitch;
+			cl_uchar *t = reinterpret_cast<cl_uchar*>(target + j*target_pitch);
+			for(size_t i = 0;i<width;++i)
+			{
+				const int c = 298*(int(y[i]) - 16) + 128;
+				const int d = int(u[i/2]) - 128;
+				const int e = int(v[i/2]) - 128;
+				t[4*i+0] = clamp8((c + 409*e) >> 8);
+				t[4*i+1] = clamp8((c - 100*d - 208*e) >> 8);
+				t[4*i+2] = clamp8((c + 516*d) >> 8);
+				t[4*i+3] = 255;
+			}
+		}
+	}
+private:
+	static cl_uchar clamp8(int x) { return cl_uchar(std::min(std::max(x, 0), 255)); }
+};
+
+// Streams host frames into Image2D objects. Each upload converts the frame
+// into one of several staging slots and enqueues a non-blocking write from
+// it, so converting frame n+1 overlaps with the device still working on
+// frame n. A slot is only reused after its previous write has completed.
+template<class Converter>
+class ImageStream {
+public:
+	typedef typename Converter::source_type source_type;
+	typedef typename Converter::target_type target_type;
+
+	ImageStream(const Context &c, size_t width, size_t height, size_t depth = 2)
+		: width_(width), height_(height), staging(depth), fences(depth), next(0), queue(c.getCurrentQueue()), context(c)
+	{
+		if(depth == 0)
+			throw std::runtime_error("stream needs at least one staging slot");
+		for(size_t i = 0;i<depth;++i)
+			staging[i].resize(width_*height_);
+	}
+
+	// uploads are enqueued on this queue, use a separate one to also
+	// overlap the transfer itself with kernels on the current queue
+	void setQueue(size_t i) { queue = i; }
+
+	Event upload(Image2D<target_type> &image, const source_type *source, size_t source_pitch = 0)
+	{
+		return upload(image, source, source_pitch, 0, 0);
+	}
+
+	Event upload(Image2D<target_type> &image, const source_type *source, size_t source_pitch, const Event &event)
+	{
+		return upload(image, source, source_pitch, 1, event.getEventPtr());
+	}
+
+	Event upload(Image2D<target_type> &image, const source_type *source, size_t source_pitch, cl_uint event_count, const cl_event *events)
+	{
+		CLP_TRACE_SCOPE("ImageStream::upload");
+		if(image.width() != width_ || image.height() != height_)
+			throw std::runtime_error("image size does not match stream");
+		if(image.isMapped())
+			throw std::runtime_error("Image mapped");
+		if(source_pitch == 0)
+			source_pitch = Converter::sourcePitch(width_);
+
+		if(fences[next].isValid())
+			fences[next].wait();
+		target_type *slot = &staging[next][0];
+		Converter::convert(source, source_pitch, slot, width_, width_, height_);
+
+		cl_event e;
+		const size_t origin[] = {0, 0, 0};
+		const size_t region[] = {width_, height_, 1};
+		cl_int error = clEnqueueWriteImage(context.getQueue(queue), *image.getMem(), CL_FALSE, origin, region, width_*sizeof(target_type), 0, slot, event_count, events, &e);
+		checkError(error);
+		CLP_TRACE_DEVICE(context.getQueue(queue), e, event_count, events, width_*height_*sizeof(target_type));
+		fences[next] = Event(e);
+		Event result = fences[next];
+		next = (next+1)%staging.size();
+		return result;
+	}
+
+	inline size_t width() const { return width_; }
+	inline size_t height() const { return height_; }
+
+	~ImageStream()
+	{
+		// the staging memory has to outlive pending writes
+		for(size_t i = 0;i<fences.size();++i)
+			if(fences[i].isValid())
+				clWaitForEvents(1, fences[i].getEventPtr());
+	}
+private:
+	ImageStream(const ImageStream&) { }
+	ImageStream& operator=(const ImageStream&) { return *this; }
+
+	size_t width_, height_;
+	std::vector< std::vector<target_type> > staging;
+	std::vector<Event> fences;
+	size_t next;
+	size_t queue;
+	Context context;
+};
+
+}
+
+#endif
@@ -1,9 +1,15 @@
 #ifndef CL_KERNEL_H
 #define CL_KERNEL_H
 
+#include <string>
+#include <type_traits>
+
 #include "CLEvent.h"
 #include "CLContext.h"
 #include "CLImage.h"
+#include "CLSampler.h"
+#include "CLSvm.h"
+#include "CLArena.h"
 
 namespace clp {
 	
@@ -64,6 +70,86 @@ struct Args< const Image2D<T> > {
 	}
 };
 
+template<class T>
+struct Args< Image3D<T> > {
+	static void set(cl_kernel kernel, int n, Image3D<T> &arg)
+	{
+		checkError(clSetKernelArg(kernel, n, sizeof(cl_mem), arg.getMem()));
+	}
+};
+
+template<class T>
+struct Args< const Image3D<T> > {
+	static void set(cl_kernel kernel, int n, const Image3D<T> &arg)
+	{
+		checkError(clSetKernelArg(kernel, n, sizeof(cl_mem), arg.getMem()));
+	}
+};
+
+template<>
+struct Args< Sampler > {
+	static void set(cl_kernel kernel, int n, Sampler &arg)
+	{
+		checkError(clSetKernelArg(kernel, n, sizeof(cl_sampler), arg.getSampler()));
+	}
+};
+
+template<>
+struct Args< const Sampler > {
+	static void set(cl_kernel kernel, int n, const Sampler &arg)
+	{
+		checkError(clSetKernelArg(kernel, n, sizeof(cl_sampler), arg.getSampler()));
+	}
+};
+
+template<class T>
+struct Args< Image1D<T> > {
+	static void set(cl_kernel kernel, int n, Image1D<T> &arg)
+	{
+		checkError(clSetKernelArg(kernel, n, sizeof(cl_mem), arg.getMem()));
+	}
+};
+
+template<class T>
+struct Args< const Image1D<T> > {
+	static void set(cl_kernel kernel, int n, const Image1D<T> &arg)
+	{
+		checkError(clSetKernelArg(kernel, n, sizeof(cl_mem), arg.getMem()));
+	}
+};
+
+template<class T>
+struct Args< Image1DBuffer<T> > {
+	static void set(cl_kernel kernel, int n, Image1DBuffer<T> &arg)
+	{
+		checkError(clSetKernelArg(kernel, n, sizeof(cl_mem), arg.getMem()));
+	}
+};
+
+template<class T>
+struct Args< const Image1DBuffer<T> > {
+	static void set(cl_kernel kernel, int n, const Image1DBuffer<T> &arg)
+	{
+		checkError(clSetKernelArg(kernel, n, sizeof(cl_mem), arg.getMem()));
+	}
+};
+
+template<class T>
+struct Args< Image2DArray<T> > {
+	static void set(cl_kernel kernel, int n, Image2DArray<T> &arg)
+	{
+		checkError(clSetKernelArg(kernel, n, sizeof(cl_mem), arg.getMem()));
+	}
+};
+
+template<class T>
+struct Args< const Image2DArray<T> > {
+	static void set(cl_kernel kernel, int n, const Image2DArray<T> &arg)
+	{
+		checkError(clSetKernelArg(kernel, n, sizeof(cl_mem), arg.getMem()));
+	}
+};
+
 template<class T>
 struct Args< Local<T> > {
 	static void set(cl_kernel kernel, int n, Local<T> arg)
@@ -72,12 +158,180 @@ struct Args< Local<T> > {
 	}
 };
 
+template<class T>
+struct Args< const Local<T> > {
+	static void set(cl_kernel kernel, int n, const Local<T> &arg)
+	{
+		checkError(clSetKernelArg(kernel, n, sizeof(T)*arg.size, 0));
+	}
+};
+
+template<class T>
+struct Args< Slice<T> > {
+	static void set(cl_kernel kernel, int n, Slice<T> &arg)
+	{
+		checkError(clSetKernelArg(kernel, n, sizeof(cl_mem), arg.getMem()));
+	}
+};
+
+template<class T>
+struct Args< const Slice<T> > {
+	static void set(cl_kernel kernel, int n, const Slice<T> &arg)
+	{
+		checkError(clSetKernelArg(kernel, n, sizeof(cl_mem), arg.getMem()));
+	}
+};
+
+#ifdef CL_VERSION_2_0
+template<class T>
+struct Args< SvmBuffer<T> > {
+	static void set(cl_kernel kernel, int n, SvmBuffer<T> &arg)
+	{
+		checkError(clSetKernelArgSVMPointer(kernel, n, arg.get()));
+	}
+};
+
+template<class T>
+struct Args< const SvmBuffer<T> > {
+	static void set(cl_kernel kernel, int n, const SvmBuffer<T> &arg)
+	{
+		checkError(clSetKernelArgSVMPointer(kernel, n, arg.get()));
+	}
+};
+
+template<class T>
+struct Args< SvmPtr<T> > {
+	static void set(cl_kernel kernel, int n, SvmPtr<T> &arg)
+	{
+		checkError(clSetKernelArgSVMPointer(kernel, n, arg.ptr));
+	}
+};
+
+template<class T>
+struct Args< const SvmPtr<T> > {
+	static void set(cl_kernel kernel, int n, const SvmPtr<T> &arg)
+	{
+		checkError(clSetKernelArgSVMPointer(kernel, n, arg.ptr));
+	}
+};
+#endif
+
 template<class T>
 void setKernelArg(cl_kernel kernel, int n, T &arg)
 {
 	Args<T>::set(kernel, n, arg);
 }
 
+#ifdef CL_VERSION_1_2
+// ArgInfo<T>::matches tells whether a signature type can bind to a kernel
+// parameter as reported by the runtime for programs built with
+// -cl-kernel-arg-info. Types without a known OpenCL C name only get their
+// address space checked.
+inline bool matchTypeName(const std::string &type, const char *name, const char *suffix)
+{
+	return name == 0 || type == std::string(name) + suffix;
+}
+
+template<class T>
+struct ArgInfo {
+	static bool matches(const std::string &type, cl_kernel_arg_address_qualifier address)
+	{
+		return address == CL_KERNEL_ARG_ADDRESS_PRIVATE && matchTypeName(type, type2name<T>::name(), "");
+	}
+};
+
+template<class T>
+struct ArgInfo<T*> {
+	static bool matches(const std::string &type, cl_kernel_arg_address_qualifier address)
+	{
+		return (address == CL_KERNEL_ARG_ADDRESS_GLOBAL || address == CL_KERNEL_ARG_ADDRESS_CONSTANT)
+			&& matchTypeName(type, type2name<typename std::remove_const<T>::type>::name(), "*");
+	}
+};
+
+template<class T>
+struct ArgInfo< Buffer<T> > : ArgInfo<T*> { };
+
+template<class T>
+struct ArgInfo< Slice<T> > : ArgInfo<T*> { };
+
+template<class T>
+struct ArgInfo< Local<T> > {
+	static bool matches(const std::string &type, cl_kernel_arg_address_qualifier address)
+	{
+		return address == CL_KERNEL_ARG_ADDRESS_LOCAL && matchTypeName(type, type2name<T>::name(), "*");
+	}
+};
+
+#define OPENCL_ARGINFO_OPAQUE(TEMPLATE,TYPE,NAME)                   \
+TEMPLATE                                                            \
+struct ArgInfo< TYPE > {                                            \
+    static bool matches(const std::string &type, cl_kernel_arg_address_qualifier) \
+    {                                                               \
+        return type == NAME;                                        \
+    }                                                               \
+};                                                                  \
+
+OPENCL_ARGINFO_OPAQUE(template<class T>, Image1D<T>, "image1d_t")
+OPENCL_ARGINFO_OPAQUE(template<class T>, Image1DBuffer<T>, "image1d_buffer_t")
+OPENCL_ARGINFO_OPAQUE(template<class T>, Image2D<T>, "image2d_t")
+OPENCL_ARGINFO_OPAQUE(template<class T>, Image2DArray<T>, "image2d_array_t")
+OPENCL_ARGINFO_OPAQUE(template<class T>, Image3D<T>, "image3d_t")
+OPENCL_ARGINFO_OPAQUE(template<>, Sampler, "sampler_t")
+
+#undef OPENCL_ARGINFO_OPAQUE
+
+#ifdef CL_VERSION_2_0
+template<class T>
+struct ArgInfo< SvmBuffer<T> > : ArgInfo<T*> { };
+
+template<class T>
+struct ArgInfo< SvmPtr<T> > : ArgInfo<T*> { };
+#endif
+
+template<class T>
+void checkKernelArg(cl_kernel kernel, const std::string &name, cl_uint index)
+{
+	cl_kernel_arg_address_qualifier address;
+	cl_int error = clGetKernelArgInfo(kernel, index, CL_KERNEL_ARG_ADDRESS_QUALIFIER, sizeof(address), &address, 0);
+	if(error == CL_KERNEL_ARG_INFO_NOT_AVAILABLE)
+		return;
+	checkError(error);
+	
+	size_t length;
+	checkError(clGetKernelArgInfo(kernel, index, CL_KERNEL_ARG_TYPE_NAME, 0, 0, &length));
+	std::string reported(length, '\0');
+	checkError(clGetKernelArgInfo(kernel, index, CL_KERNEL_ARG_TYPE_NAME, length, &reported[0], 0));
+	std::string type;
+	for(size_t i = 0;i<reported.size();++i)
+		if(reported[i] != ' ' && reported[i] != '\0')
+			type += reported[i];
+	
+	if(!ArgInfo<T>::matches(type, address))
+		throw std::runtime_error("kernel " + name + ": argument " + std::to_string(index) + " of type " + type + " does not match the signature");
+}
+
+// Validates a kernel signature F against the argument info of a kernel,
+// does nothing if the program was built without -cl-kernel-arg-info.
+template<class F>
+struct KernelSignature {
+};
+
+template<class... T>
+struct KernelSignature<void(T...)> {
+	static void check(cl_kernel kernel, const std::string &name)
+	{
+		cl_uint count;
+		checkError(clGetKernelInfo(kernel, CL_KERNEL_NUM_ARGS, sizeof(count), &count, 0));
+		if(count != sizeof...(T))
+			throw std::runtime_error("kernel " + name + " takes " + std::to_string(count) + " arguments, signature has " + std::to_string(sizeof...(T)));
+		cl_uint index = 0;
+		int expand[] = {0, (checkKernelArg<T>(kernel, name, index++), 0)...};
+		(void)expand;
+	}
+};
+#endif
+
 struct Worksize {
 	Worksize(size_t g1, size_t l1) : dim(1)
 	{
@@ -94,6 +348,8 @@ struct Worksize {
 		global[0] = g1; global[1] = g2; global[2] = g3;
 		local[0] = l1; local[1] = l2; local[2] = l3;
 	}
+	// a local size of 0 leaves the work-group size to the implementation
+	const size_t* getLocal() const { return local[0] ? local : 0; }
 	size_t global[3];
 	size_t local[3];
 	cl_uint dim;
@@ -126,10 +382,14 @@ public:
 	
 	Event operator()(const Worksize &ws, A0 &arg0, cl_uint event_count, const cl_event *events)
 	{
+		CLP_TRACE_SCOPE("Kernel");
+		CLP_TRACE_KERNEL(kernel);
+		const Residency::Launch launch = context.beginLaunch();
 		setKernelArg(kernel, 0, arg0);
 		cl_event event;
-		cl_int error = clEnqueueNDRangeKernel(context.getQueue(), kernel, ws.dim, 0, ws.global, ws.local, event_count, events, &event);
+		cl_int error = clEnqueueNDRangeKernel(context.getQueue(), kernel, ws.dim, 0, ws.global, ws.getLocal(), event_count, events, &event);
 		checkError(error);
+		CLP_TRACE_DEVICE(context.getQueue(), event, event_count, events, 0);
 		return Event(event);
 	}
 	
@@ -166,11 +426,15 @@ public:
 	
 	Event operator()(const Worksize &ws, A0 &arg0, A1 &arg1, cl_uint event_count, const cl_event *events)
 	{
+		CLP_TRACE_SCOPE("Kernel");
+		CLP_TRACE_KERNEL(kernel);
+		const Residency::Launch launch = context.beginLaunch();
 		setKernelArg(kernel, 0, arg0);
 		setKernelArg(kernel, 1, arg1);
 		cl_event event;
-		cl_int error = clEnqueueNDRangeKernel(context.getQueue(), kernel, ws.dim, 0, ws.global, ws.local, event_count, events, &event);
+		cl_int error = clEnqueueNDRangeKernel(context.getQueue(), kernel, ws.dim, 0, ws.global, ws.getLocal(), event_count, events, &event);
 		checkError(error);
+		CLP_TRACE_DEVICE(context.getQueue(), event, event_count, events, 0);
 		return Event(event);
 	}
 	
@@ -208,12 +472,16 @@ public:
 	
 	Event operator()(const Worksize &ws, A0 &arg0, A1 &arg1, A2 &arg2, cl_uint event_count, const cl_event *events)
 	{
+		CLP_TRACE_SCOPE("Kernel");
+		CLP_TRACE_KERNEL(kernel);
+		const Residency::Launch launch = context.beginLaunch();
 		setKernelArg(kernel, 0, arg0);
 		setKernelArg(kernel, 1, arg1);
 		setKernelArg(kernel, 2, arg2);
 		cl_event event;
-		cl_int error = clEnqueueNDRangeKernel(context.getQueue(), kernel, ws.dim, 0, ws.global, ws.local, event_count, events, &event);
+		cl_int error = clEnqueueNDRangeKernel(context.getQueue(), kernel, ws.dim, 0, ws.global, ws.getLocal(), event_count, events, &event);
 		checkError(error);
+		CLP_TRACE_DEVICE(context.getQueue(), event, event_count, events, 0);
 		return Event(event);
 	}
 	
@@ -253,13 +521,233 @@ public:
 	
 	Event operator()(const Worksize &ws, A0 &arg0, A1 &arg1, A2 &arg2, A3 &arg3, cl_uint event_count, const cl_event *events)
 	{
+		CLP_TRACE_SCOPE("Kernel");
+		CLP_TRACE_KERNEL(kernel);
+		const Residency::Launch launch = context.beginLaunch();
+		setKernelArg(kernel, 0, arg0);
+		setKernelArg(kernel, 1, arg1);
+		setKernelArg(kernel, 2, arg2);
+		setKernelArg(kernel, 3, arg3);
+		cl_event event;
+		cl_int error = clEnqueueNDRangeKernel(context.getQueue(), kernel, ws.dim, 0, ws.global, ws.getLocal(), event_count, events, &event);
+		checkError(error);
+		CLP_TRACE_DEVICE(context.getQueue(), event, event_count, events, 0);
+		return Event(event);
+	}
+	
+	~Kernel()
+	{
+		checkError(clReleaseKernel(kernel));
+	}
+private:
+	cl_kernel kernel;
+	Context context;
+};
+
+template<class T0, class T1, class T2, class T3, class T4>
+class Kernel<void(T0, T1, T2, T3, T4)> {
+public:
+	Kernel(const Context &c, cl_kernel k) : kernel(k), context(c) {}
+	Kernel(const Kernel &k) : kernel(k.kernel), context(k.context)
+	{
+		checkError(clRetainKernel(kernel));
+	}
+	
+	typedef typename translate<T0>::type A0;
+	typedef typename translate<T1>::type A1;
+	typedef typename translate<T2>::type A2;
+	typedef typename translate<T3>::type A3;
+	typedef typename translate<T4>::type A4;
+	
+	Event operator()(const Worksize &ws, A0 &arg0, A1 &arg1, A2 &arg2, A3 &arg3, A4 &arg4)
+	{
+		return operator()(ws, arg0, arg1, arg2, arg3, arg4, 0, 0);
+	}
+	
+	Event operator()(const Worksize &ws, A0 &arg0, A1 &arg1, A2 &arg2, A3 &arg3, A4 &arg4, const Event &event)
+	{
+		return operator()(ws, arg0, arg1, arg2, arg3, arg4, 1, event.getEventPtr());
+	}
+	
+	Event operator()(const Worksize &ws, A0 &arg0, A1 &arg1, A2 &arg2, A3 &arg3, A4 &arg4, cl_uint event_count, const cl_event *events)
+	{
+		CLP_TRACE_SCOPE("Kernel");
+		CLP_TRACE_KERNEL(kernel);
+		const Residency::Launch launch = context.beginLaunch();
+		setKernelArg(kernel, 0, arg0);
+		setKernelArg(kernel, 1, arg1);
+		setKernelArg(kernel, 2, arg2);
+		setKernelArg(kernel, 3, arg3);
+		setKernelArg(kernel, 4, arg4);
+		cl_event event;
+		cl_int error = clEnqueueNDRangeKernel(context.getQueue(), kernel, ws.dim, 0, ws.global, ws.getLocal(), event_count, events, &event);
+		checkError(error);
+		CLP_TRACE_DEVICE(context.getQueue(), event, event_count, events, 0);
+		return Event(event);
+	}
+	
+	~Kernel()
+	{
+		checkError(clReleaseKernel(kernel));
+	}
+private:
+	cl_kernel kernel;
+	Context context;
+};
+
+template<class T0, class T1, class T2, class T3, class T4, class T5>
+class Kernel<void(T0, T1, T2, T3, T4, T5)> {
+public:
+	Kernel(const Context &c, cl_kernel k) : kernel(k), context(c) {}
+	Kernel(const Kernel &k) : kernel(k.kernel), context(k.context)
+	{
+		checkError(clRetainKernel(kernel));
+	}
+	
+	typedef typename translate<T0>::type A0;
+	typedef typename translate<T1>::type A1;
+	typedef typename translate<T2>::type A2;
+	typedef typename translate<T3>::type A3;
+	typedef typename translate<T4>::type A4;
+	typedef typename translate<T5>::type A5;
+	
+	Event operator()(const Worksize &ws, A0 &arg0, A1 &arg1, A2 &arg2, A3 &arg3, A4 &arg4, A5 &arg5)
+	{
+		return operator()(ws, arg0, arg1, arg2, arg3, arg4, arg5, 0, 0);
+	}
+	
+	Event operator()(const Worksize &ws, A0 &arg0, A1 &arg1, A2 &arg2, A3 &arg3, A4 &arg4, A5 &arg5, const Event &event)
+	{
+		return operator()(ws, arg0, arg1, arg2, arg3, arg4, arg5, 1, event.getEventPtr());
+	}
+	
+	Event operator()(const Worksize &ws, A0 &arg0, A1 &arg1, A2 &arg2, A3 &arg3, A4 &arg4, A5 &arg5, cl_uint event_count, const cl_event *events)
+	{
+		CLP_TRACE_SCOPE("Kernel");
+		CLP_TRACE_KERNEL(kernel);
+		const Residency::Launch launch = context.beginLaunch();
+		setKernelArg(kernel, 0, arg0);
+		setKernelArg(kernel, 1, arg1);
+		setKernelArg(kernel, 2, arg2);
+		setKernelArg(kernel, 3, arg3);
+		setKernelArg(kernel, 4, arg4);
+		setKernelArg(kernel, 5, arg5);
+		cl_event event;
+		cl_int error = clEnqueueNDRangeKernel(context.getQueue(), kernel, ws.dim, 0, ws.global, ws.getLocal(), event_count, events, &event);
+		checkError(error);
+		CLP_TRACE_DEVICE(context.getQueue(), event, event_count, events, 0);
+		return Event(event);
+	}
+	
+	~Kernel()
+	{
+		checkError(clReleaseKernel(kernel));
+	}
+private:
+	cl_kernel kernel;
+	Context context;
+};
+
+template<class T0, class T1, class T2, class T3, class T4, class T5, class T6>
+class Kernel<void(T0, T1, T2, T3, T4, T5, T6)> {
+public:
+	Kernel(const Context &c, cl_kernel k) : kernel(k), context(c) {}
+	Kernel(const Kernel &k) : kernel(k.kernel), context(k.context)
+	{
+		checkError(clRetainKernel(kernel));
+	}
+	
+	typedef typename translate<T0>::type A0;
+	typedef typename translate<T1>::type A1;
+	typedef typename translate<T2>::type A2;
+	typedef typename translate<T3>::type A3;
+	typedef typename translate<T4>::type A4;
+	typedef typename translate<T5>::type A5;
+	typedef typename translate<T6>::type A6;
+	
+	Event operator()(const Worksize &ws, A0 &arg0, A1 &arg1, A2 &arg2, A3 &arg3, A4 &arg4, A5 &arg5, A6 &arg6)
+	{
+		return operator()(ws, arg0, arg1, arg2, arg3, arg4, arg5, arg6, 0, 0);
+	}
+	
+	Event operator()(const Worksize &ws, A0 &arg0, A1 &arg1, A2 &arg2, A3 &arg3, A4 &arg4, A5 &arg5, A6 &arg6, const Event &event)
+	{
+		return operator()(ws, arg0, arg1, arg2, arg3, arg4, arg5, arg6, 1, event.getEventPtr());
+	}
+	
+	Event operator()(const Worksize &ws, A0 &arg0, A1 &arg1, A2 &arg2, A3 &arg3, A4 &arg4, A5 &arg5, A6 &arg6, cl_uint event_count, const cl_event *events)
+	{
+		CLP_TRACE_SCOPE("Kernel");
+		CLP_TRACE_KERNEL(kernel);
+		const Residency::Launch launch = context.beginLaunch();
+		setKernelArg(kernel, 0, arg0);
+		setKernelArg(kernel, 1, arg1);
+		setKernelArg(kernel, 2, arg2);
+		setKernelArg(kernel, 3, arg3);
+		setKernelArg(kernel, 4, arg4);
+		setKernelArg(kernel, 5, arg5);
+		setKernelArg(kernel, 6, arg6);
+		cl_event event;
+		cl_int error = clEnqueueNDRangeKernel(context.getQueue(), kernel, ws.dim, 0, ws.global, ws.getLocal(), event_count, events, &event);
+		checkError(error);
+		CLP_TRACE_DEVICE(context.getQueue(), event, event_count, events, 0);
+		return Event(event);
+	}
+	
+	~Kernel()
+	{
+		checkError(clReleaseKernel(kernel));
+	}
+private:
+	cl_kernel kernel;
+	Context context;
+};
+
+template<class T0, class T1, class T2, class T3, class T4, class T5, class T6, class T7>
+class Kernel<void(T0, T1, T2, T3, T4, T5, T6, T7)> {
+public:
+	Kernel(const Context &c, cl_kernel k) : kernel(k), context(c) {}
+	Kernel(const Kernel &k) : kernel(k.kernel), context(k.context)
+	{
+		checkError(clRetainKernel(kernel));
+	}
+	
+	typedef typename translate<T0>::type A0;
+	typedef typename translate<T1>::type A1;
+	typedef typename translate<T2>::type A2;
+	typedef typename translate<T3>::type A3;
+	typedef typename translate<T4>::type A4;
+	typedef typename translate<T5>::type A5;
+	typedef typename translate<T6>::type A6;
+	typedef typename translate<T7>::type A7;
+	
+	Event operator()(const Worksize &ws, A0 &arg0, A1 &arg1, A2 &arg2, A3 &arg3, A4 &arg4, A5 &arg5, A6 &arg6, A7 &arg7)
+	{
+		return operator()(ws, arg0, arg1, arg2, arg3, arg4, arg5, arg6, arg7, 0, 0);
+	}
+	
+	Event operator()(const Worksize &ws, A0 &arg0, A1 &arg1, A2 &arg2, A3 &arg3, A4 &arg4, A5 &arg5, A6 &arg6, A7 &arg7, const Event &event)
+	{
+		return operator()(ws, arg0, arg1, arg2, arg3, arg4, arg5, arg6, arg7, 1, event.getEventPtr());
+	}
+	
+	Event operator()(const Worksize &ws, A0 &arg0, A1 &arg1, A2 &arg2, A3 &arg3, A4 &arg4, A5 &arg5, A6 &arg6, A7 &arg7, cl_uint event_count, const cl_event *events)
+	{
+		CLP_TRACE_SCOPE("Kernel");
+		CLP_TRACE_KERNEL(kernel);
+		const Residency::Launch launch = context.beginLaunch();
 		setKernelArg(kernel, 0, arg0);
 		setKernelArg(kernel, 1, arg1);
 		setKernelArg(kernel, 2, arg2);
 		setKernelArg(kernel, 3, arg3);
+		setKernelArg(kernel, 4, arg4);
+		setKernelArg(kernel, 5, arg5);
+		setKernelArg(kernel, 6, arg6);
+		setKernelArg(kernel, 7, arg7);
 		cl_event event;
-		cl_int error = clEnqueueNDRangeKernel(context.getQueue(), kernel, ws.dim, 0, ws.global, ws.local, event_count, events, &event);
+		cl_int error = clEnqueueNDRangeKernel(context.getQueue(), kernel, ws.dim, 0, ws.global, ws.getLocal(), event_count, events, &event);
 		checkError(error);
+		CLP_TRACE_DEVICE(context.getQueue(), event, event_count, events, 0);
 		return Event(event);
 	}
 	
@@ -1,55 +1,317 @@
 #ifndef CL_PROGRAM_H
 #define CL_PROGRAM_H
 
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
 #include "CLKernel.h"
 
 namespace clp
 {
 
+// Copies of a Program share the same underlying cl_program and its
+// kernel cache.
 class Program {
 public:
 	Program(const Context &c)
-		: context(c)
-	{		
+		: data(new ProgramData), context(c)
+	{
 	}
 
 	void setSource(const std::string &s)
 	{
-		source = s;
+		data->source = s;
+	}
+
+	// When enabled the program is built with -cl-kernel-arg-info and
+	// getKernel validates the requested signature against the kernel.
+	void setCheckSignatures(bool check)
+	{
+		data->check_signatures = check;
+	}
+
+	void build(const std::string &options = "")
+	{
+		create();
+		cl_int error = clBuildProgram(data->program, 0, 0, flags(options).c_str(), 0, 0);
+		if(error != CL_SUCCESS)
+			throw std::runtime_error(getBuildLog());
+		data->built = true;
+	}
+
+#ifdef CL_VERSION_1_2
+	// Compiles without linking, for use with link(). The headers are
+	// programs created from source that #include directives can refer to
+	// by the given names.
+	void compile(const std::string &options = "")
+	{
+		compile(options, 0, 0, 0);
 	}
 
-	void build()
+	void compile(const std::string &options, cl_uint header_count, const cl_program *headers, const char **header_names)
 	{
-		const char *s[] = {source.c_str()};
-		size_t length = source.size();
+		create();
+		cl_int error = clCompileProgram(data->program, 0, 0, flags(options).c_str(), header_count, headers, header_names, 0, 0);
+		if(error != CL_SUCCESS)
+			throw std::runtime_error(getBuildLog());
+	}
+
+	// Links previously compiled programs into this one.
+	void link(const std::vector<Program> &objects, const std::string &options = "")
+	{
+		std::vector<cl_program> programs(objects.size());
+		for(size_t i = 0;i<objects.size();++i)
+			programs[i] = objects[i].getProgram();
+		release();
 		cl_int error;
-		program = clCreateProgramWithSource(context.getContext(), 1, s, &length, &error);
-		checkError(error);
-		
-		error = clBuildProgram(program, 0, 0, "", 0, 0);
+		data->program = clLinkProgram(context.getContext(), 0, 0, flags(options).c_str(), cl_uint(programs.size()), programs.data(), 0, 0, &error);
 		if(error != CL_SUCCESS)
 		{
-			size_t length;
-			clGetProgramBuildInfo(program, context.getDevice(), CL_PROGRAM_BUILD_LOG, 0, 0, &length);
-			std::string log; log.resize(length);
-			clGetProgramBuildInfo(program, context.getDevice(), CL_PROGRAM_BUILD_LOG, length, &log[0], 0);
-			throw std::runtime_error(log);
+			if(data->program == 0)
+				checkError(error);
+			throw std::runtime_error(getBuildLog());
 		}
+		data->built = true;
 	}
-	
+#endif
+
+	std::string getBuildLog() const
+	{
+		size_t length;
+		clGetProgramBuildInfo(data->program, context.getDevice(), CL_PROGRAM_BUILD_LOG, 0, 0, &length);
+		std::string log; log.resize(length);
+		clGetProgramBuildInfo(data->program, context.getDevice(), CL_PROGRAM_BUILD_LOG, length, &log[0], 0);
+		return log;
+	}
+
+	// Every call returns an independent kernel, cloned from one created
+	// per name where clCloneKernel is available, so its argument state is
+	// not shared with other callers.
 	template<class T>
 	Kernel<T> getKernel(const std::string &name)
 	{
+		cl_kernel kernel = newInstance(name, 0);
+		try
+		{
+			checkSignature<T>(kernel, name);
+		}
+		catch(...)
+		{
+			clReleaseKernel(kernel);
+			throw;
+		}
+		return Kernel<T>(context, kernel);
+	}
+
+	// Returns the calling thread's instance of a kernel, created on its
+	// first request like getKernel, so a thread launching a kernel
+	// repeatedly does not create one per launch. Instances are owned by the
+	// program and released when it is rebuilt or destroyed, or when the
+	// thread exits.
+	template<class T>
+	Kernel<T> getThreadKernel(const std::string &name)
+	{
+		ThreadKernels &cache = threadKernels();
+		std::pair<cl_ulong, std::string> key(0, name);
+		{
+			std::lock_guard<std::mutex> lock(data->kernel_mutex);
+			key.first = data->id;
+		}
+		ThreadKernels::Map::iterator i = cache.kernels.find(key);
 		cl_kernel kernel;
-		cl_int error;
-		kernel = clCreateKernel(program, name.c_str(), &error);
-		checkError(error);
+		if(i != cache.kernels.end())
+		{
+			kernel = i->second.kernel;
+		}
+		else
+		{
+			cache.purge();
+			kernel = newInstance(name, &key.first);
+			ThreadKernel entry = {kernel, data};
+			cache.kernels[key] = entry;
+		}
+		checkSignature<T>(kernel, name);
+		checkError(clRetainKernel(kernel));
 		return Kernel<T>(context, kernel);
 	}
-	
+
+	cl_program getProgram() const { return data->program; }
+	const std::string& getSource() const { return data->source; }
+	bool isBuilt() const { return data->built; }
+
 private:
-	cl_program program;
-	std::string source;
+	void create()
+	{
+		release();
+		const char *s[] = {data->source.c_str()};
+		size_t length = data->source.size();
+		cl_int error;
+		data->program = clCreateProgramWithSource(context.getContext(), 1, s, &length, &error);
+		checkError(error);
+	}
+
+	void release()
+	{
+		std::lock_guard<std::mutex> lock(data->kernel_mutex);
+		data->releaseKernels();
+		if(data->program)
+			clReleaseProgram(data->program);
+		data->program = 0;
+		data->built = false;
+		data->id = nextId();
+	}
+
+	// A new kernel owned by the caller, or by the program when clone_id is
+	// given, which then receives the id of the build it belongs to. The
+	// program is only read under the lock, a concurrent rebuild replaces it.
+	cl_kernel newInstance(const std::string &name, cl_ulong *clone_id)
+	{
+		std::lock_guard<std::mutex> lock(data->kernel_mutex);
+		cl_int error;
+		std::map<std::string, cl_kernel>::iterator i = data->kernels.find(name);
+		if(i == data->kernels.end())
+		{
+			cl_kernel shared = clCreateKernel(data->program, name.c_str(), &error);
+			checkError(error);
+			i = data->kernels.insert(std::make_pair(name, shared)).first;
+		}
+		cl_kernel kernel = 0;
+		error = CL_INVALID_OPERATION;
+#ifdef CL_VERSION_2_1
+		kernel = clCloneKernel(i->second, &error);
+#endif
+		if(error != CL_SUCCESS)
+		{
+			kernel = clCreateKernel(data->program, name.c_str(), &error);
+			checkError(error);
+		}
+		if(clone_id)
+		{
+			data->clones.push_back(kernel);
+			*clone_id = data->id;
+		}
+		return kernel;
+	}
+
+	// Every request is checked, since instances of one name are handed to
+	// callers asking for different signatures.
+	template<class T>
+	void checkSignature(cl_kernel kernel, const std::string &name) const
+	{
+#ifdef CL_VERSION_1_2
+		if(data->check_signatures)
+			KernelSignature<T>::check(kernel, name);
+#endif
+	}
+
+	// ids tell thread local kernels of different (re)builds apart
+	static cl_ulong nextId()
+	{
+		static std::atomic<cl_ulong> counter(0);
+		return ++counter;
+	}
+
+	struct ProgramData {
+		ProgramData() : program(0), check_signatures(false), built(false), id(nextId()) { }
+		cl_program program;
+		bool check_signatures;
+		bool built;
+		cl_ulong id;
+		std::string source;
+		std::map<std::string, cl_kernel> kernels;
+		// per thread instances handed out by getThreadKernel
+		std::vector<cl_kernel> clones;
+		std::mutex kernel_mutex;
+		void releaseKernels()
+		{
+			for(std::map<std::string, cl_kernel>::iterator i = kernels.begin();i!=kernels.end();++i)
+				clReleaseKernel(i->second);
+			kernels.clear();
+			for(size_t i = 0;i<clones.size();++i)
+				clReleaseKernel(clones[i]);
+			clones.clear();
+		}
+		void releaseClone(cl_kernel kernel)
+		{
+			std::vector<cl_kernel>::iterator i = std::find(clones.begin(), clones.end(), kernel);
+			if(i != clones.end())
+			{
+				clReleaseKernel(kernel);
+				clones.erase(i);
+			}
+		}
+		~ProgramData()
+		{
+			releaseKernels();
+			if(program)
+				clReleaseProgram(program);
+		}
+	};
+
+	// the calling thread's kernel instances, by program id and name
+	struct ThreadKernel {
+		cl_kernel kernel;
+		std::weak_ptr<ProgramData> owner;
+	};
+
+	struct ThreadKernels {
+		typedef std::map<std::pair<cl_ulong, std::string>, ThreadKernel> Map;
+		Map kernels;
+
+		// drops the entries of programs rebuilt or destroyed since, their
+		// instances were already released by the program
+		void purge()
+		{
+			for(Map::iterator i = kernels.begin();i!=kernels.end();)
+			{
+				std::shared_ptr<ProgramData> owner = i->second.owner.lock();
+				bool stale = !owner;
+				if(owner)
+				{
+					std::lock_guard<std::mutex> lock(owner->kernel_mutex);
+					stale = owner->id != i->first.first;
+				}
+				if(stale)
+					kernels.erase(i++);
+				else
+					++i;
+			}
+		}
+
+		~ThreadKernels()
+		{
+			for(Map::iterator i = kernels.begin();i!=kernels.end();++i)
+			{
+				std::shared_ptr<ProgramData> owner = i->second.owner.lock();
+				if(!owner)
+					continue;
+				std::lock_guard<std::mutex> lock(owner->kernel_mutex);
+				if(owner->id == i->first.first)
+					owner->releaseClone(i->second.kernel);
+			}
+		}
+	};
+
+	static ThreadKernels& threadKernels()
+	{
+		static thread_local ThreadKernels cache;
+		return cache;
+	}
+
+	std::string flags(const std::string &options) const
+	{
+		std::string result = options;
+		if(data->check_signatures)
+			result += " -cl-kernel-arg-info";
+		return result;
+	}
+
+	std::shared_ptr<ProgramData> data;
 	Context context;
 };
 
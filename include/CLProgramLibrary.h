@@ -0,0 +1,218 @@
+#ifndef CL_PROGRAMLIBRARY_H
+#define CL_PROGRAMLIBRARY_H
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#include "CLProgram.h"
+
+namespace clp
+{
+
+// Registry of named programs that are built in parallel on host threads
+// or lazily on first use. Everything has to be registered before the
+// first build. With headers registered, programs are compiled and linked
+// separately so their sources can #include the headers by name.
+class ProgramLibrary {
+public:
+	ProgramLibrary(const Context &c)
+		: context(c)
+	{
+	}
+
+#ifdef CL_VERSION_1_2
+	void addHeader(const std::string &name, const std::string &source)
+	{
+		const char *s[] = {source.c_str()};
+		size_t length = source.size();
+		cl_int error;
+		cl_program header = clCreateProgramWithSource(context.getContext(), 1, s, &length, &error);
+		checkError(error);
+		headers.push_back(header);
+		header_names.push_back(name);
+	}
+#endif
+
+	void add(const std::string &name, const std::string &source, const std::string &options = "")
+	{
+		insert(name, Executable, source, options);
+	}
+
+#ifdef CL_VERSION_1_2
+	// a compiled but unlinked unit, only usable in addLinked
+	void addObject(const std::string &name, const std::string &source, const std::string &options = "")
+	{
+		insert(name, Object, source, options);
+	}
+
+	void addLinked(const std::string &name, const std::vector<std::string> &objects, const std::string &options = "")
+	{
+		for(size_t i = 0;i<objects.size();++i)
+			if(find(objects[i]).kind != Object)
+				throw std::runtime_error("program " + objects[i] + " is not an object");
+		Entry &entry = insert(name, Linked, "", options);
+		entry.objects = objects;
+	}
+#endif
+
+	// Builds everything that is not built yet using up to threads host
+	// threads (0 picks the hardware concurrency). Failures are collected
+	// and reported together after all builds finished.
+	void buildAll(size_t threads = 0)
+	{
+		std::vector<Entry*> pending;
+		for(std::map<std::string, std::unique_ptr<Entry> >::iterator i = entries.begin();i!=entries.end();++i)
+			pending.push_back(i->second.get());
+		if(threads == 0)
+			threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+		threads = std::min(threads, pending.size());
+
+		std::atomic<size_t> next(0);
+		std::mutex error_mutex;
+		std::string errors;
+		std::vector<std::thread> workers;
+		for(size_t t = 0;t<threads;++t)
+		{
+			workers.push_back(std::thread([&]() {
+				for(size_t i = next++;i<pending.size();i = next++)
+				{
+					try
+					{
+						ensureBuilt(*pending[i]);
+					}
+					catch(const std::exception &e)
+					{
+						std::lock_guard<std::mutex> lock(error_mutex);
+						errors += pending[i]->name + ": " + e.what() + "\n";
+					}
+				}
+			}));
+		}
+		for(size_t t = 0;t<workers.size();++t)
+			workers[t].join();
+		if(!errors.empty())
+			throw std::runtime_error(errors);
+	}
+
+	// returns the program, building it first if needed
+	Program get(const std::string &name)
+	{
+		Entry &entry = find(name);
+		ensureBuilt(entry);
+		return entry.program;
+	}
+
+	template<class T>
+	Kernel<T> getKernel(const std::string &program, const std::string &kernel)
+	{
+		return get(program).getKernel<T>(kernel);
+	}
+
+	bool isBuilt(const std::string &name)
+	{
+		Entry &entry = find(name);
+		std::lock_guard<std::mutex> lock(entry.mutex);
+		return entry.done;
+	}
+
+	~ProgramLibrary()
+	{
+		for(size_t i = 0;i<headers.size();++i)
+			clReleaseProgram(headers[i]);
+	}
+private:
+	ProgramLibrary(const ProgramLibrary&);
+	ProgramLibrary& operator=(const ProgramLibrary&);
+
+	enum Kind { Executable, Object, Linked };
+
+	struct Entry {
+		Entry(const Context &c) : program(c), done(false) { }
+		std::string name;
+		Kind kind;
+		std::string options;
+		std::vector<std::string> objects;
+		Program program;
+		bool done;
+		std::mutex mutex;
+	};
+
+	Entry& insert(const std::string &name, Kind kind, const std::string &source, const std::string &options)
+	{
+		std::unique_ptr<Entry> &entry = entries[name];
+		if(entry)
+			throw std::runtime_error("program " + name + " already registered");
+		entry.reset(new Entry(context));
+		entry->name = name;
+		entry->kind = kind;
+		entry->options = options;
+		entry->program.setSource(source);
+		return *entry;
+	}
+
+	Entry& find(const std::string &name)
+	{
+		std::map<std::string, std::unique_ptr<Entry> >::iterator i = entries.find(name);
+		if(i == entries.end())
+			throw std::runtime_error("no program named " + name);
+		return *i->second;
+	}
+
+	void ensureBuilt(Entry &entry)
+	{
+		std::lock_guard<std::mutex> lock(entry.mutex);
+		if(entry.done)
+			return;
+#ifdef CL_VERSION_1_2
+		if(entry.kind == Object)
+		{
+			compile(entry.program, entry.options);
+		}
+		else if(entry.kind == Linked)
+		{
+			std::vector<Program> objects;
+			for(size_t i = 0;i<entry.objects.size();++i)
+			{
+				Entry &object = find(entry.objects[i]);
+				ensureBuilt(object);
+				objects.push_back(object.program);
+			}
+			entry.program.link(objects, entry.options);
+		}
+		else if(!headers.empty())
+		{
+			Program object(context);
+			object.setSource(entry.program.getSource());
+			compile(object, entry.options);
+			entry.program.link(std::vector<Program>(1, object));
+		}
+		else
+#endif
+		{
+			entry.program.build(entry.options);
+		}
+		entry.done = true;
+	}
+
+#ifdef CL_VERSION_1_2
+	void compile(Program &program, const std::string &options)
+	{
+		std::vector<const char*> names(header_names.size());
+		for(size_t i = 0;i<header_names.size();++i)
+			names[i] = header_names[i].c_str();
+		program.compile(options, cl_uint(headers.size()), headers.data(), names.data());
+	}
+#endif
+
+	std::map<std::string, std::unique_ptr<Entry> > entries;
+	std::vector<cl_program> headers;
+	std::vector<std::string> header_names;
+	Context context;
+};
+
+} // end namespace clp
+
+#endif
@@ -0,0 +1,301 @@
+#ifndef CL_RESIDENCY_H
+#define CL_RESIDENCY_H
+
+#include <algorithm>
+#include <chrono>
+#include <list>
+#include <mutex>
+#include <vector>
+
+#define CL_USE_DEPRECATED_OPENCL_1_1_APIS
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "CLUtility.h"
+
+namespace clp
+{
+
+struct ResidencyStats {
+	cl_ulong budget;
+	cl_ulong resident_bytes;
+	cl_ulong peak_resident_bytes;
+	cl_ulong evictions;
+	cl_ulong restores;
+	cl_ulong bytes_evicted;
+	cl_ulong bytes_restored;
+	// host time spent evicting and restoring, and retrying allocations
+	double stall_seconds;
+};
+
+// Keeps the buffers of a context within a device memory budget, enabled
+// by Context::setMemoryBudget. When an allocation or a restore would
+// exceed the budget, or the runtime fails to allocate, the least recently
+// used buffers are copied to host backing storage and their device memory
+// is released. An evicted buffer is restored the next time it is used by a
+// transfer, a mapping or a kernel launch.
+//
+// Buffers used by the launch being prepared are never evicted: Kernel
+// holds a Launch from before binding its arguments until the launch is
+// enqueued, which starts a new epoch in which every bound buffer stays
+// resident, and keeps other threads' transfers and launches from evicting
+// them meanwhile. Mapped buffers and buffers aliased by images are not
+// evicted either. An eviction first finishes every queue of the context,
+// in or out of order, so no enqueued command still uses the buffer, then
+// reads it back through the current queue. Restores write it back
+// synchronously.
+class Residency {
+public:
+	struct Entry {
+		cl_mem *mem;
+		size_t bytes;
+		cl_mem_flags flags;
+		cl_ulong epoch;
+		size_t pins;
+		bool resident;
+		// the buffer was destroyed while pinned, the entry keeps
+		// accounting for its memory until the last pin is released
+		bool removed;
+		std::vector<char> backing;
+		std::list<Entry>::iterator self;
+	};
+
+	Residency(cl_context c, const std::vector<cl_command_queue> &q, cl_ulong b)
+		: context(c), queues(q), epoch(0), stats(ResidencyStats())
+	{
+		stats.budget = b;
+	}
+
+	// Creates the device memory of a buffer, *mem is updated whenever the
+	// buffer is evicted or restored. source is passed on for
+	// CL_MEM_COPY_HOST_PTR.
+	Entry* add(cl_mem *mem, size_t bytes, cl_mem_flags flags, void *source, cl_command_queue queue)
+	{
+		std::lock_guard<std::recursive_mutex> lock(mutex);
+		++epoch;
+		entries.push_back(Entry());
+		Entry &e = entries.back();
+		e.self = --entries.end();
+		e.mem = mem;
+		e.bytes = bytes;
+		e.flags = flags & ~cl_mem_flags(CL_MEM_COPY_HOST_PTR);
+		e.epoch = epoch;
+		e.pins = 0;
+		e.resident = false;
+		e.removed = false;
+		try
+		{
+			*mem = allocate(e, flags, source, queue);
+		}
+		catch(...)
+		{
+			entries.erase(e.self);
+			throw;
+		}
+		e.resident = true;
+		stats.resident_bytes += bytes;
+		stats.peak_resident_bytes = std::max(stats.peak_resident_bytes, stats.resident_bytes);
+		return &e;
+	}
+
+	// Releases the buffer's reference to its memory. A pinned entry stays
+	// until it is unpinned, since the objects aliasing the memory keep it
+	// alive.
+	void remove(Entry *e)
+	{
+		std::lock_guard<std::recursive_mutex> lock(mutex);
+		if(e->resident)
+			clReleaseMemObject(*e->mem);
+		e->mem = 0;
+		if(e->pins)
+			e->removed = true;
+		else
+			erase(*e);
+	}
+
+	// Makes e resident for a use in the current epoch and marks it most
+	// recently used.
+	void touch(Entry *e, cl_command_queue queue)
+	{
+		std::lock_guard<std::recursive_mutex> lock(mutex);
+		touchLocked(*e, queue);
+	}
+
+	// touch for a command that uses e alone, such as a transfer
+	void use(Entry *e, cl_command_queue queue)
+	{
+		std::lock_guard<std::recursive_mutex> lock(mutex);
+		++epoch;
+		touchLocked(*e, queue);
+	}
+
+	// pinned entries are not evicted, pins nest
+	void pin(Entry *e, cl_command_queue queue)
+	{
+		std::lock_guard<std::recursive_mutex> lock(mutex);
+		++epoch;
+		touchLocked(*e, queue);
+		++e->pins;
+	}
+
+	void unpin(Entry *e)
+	{
+		std::lock_guard<std::recursive_mutex> lock(mutex);
+		if(e->pins)
+			--e->pins;
+		if(e->removed && e->pins == 0)
+			erase(*e);
+	}
+
+	// Locks the residency of a context from before the arguments of a
+	// launch are bound until it is enqueued, does nothing without one.
+	class Launch {
+	public:
+		explicit Launch(Residency *r)
+			: residency(r)
+		{
+			if(residency)
+			{
+				residency->mutex.lock();
+				++residency->epoch;
+			}
+		}
+
+		Launch(Launch &&l)
+			: residency(l.residency)
+		{
+			l.residency = 0;
+		}
+
+		~Launch()
+		{
+			if(residency)
+				residency->mutex.unlock();
+		}
+	private:
+		Launch(const Launch&);
+		Launch& operator=(const Launch&);
+
+		Residency *residency;
+	};
+
+	void setBudget(cl_ulong bytes)
+	{
+		std::lock_guard<std::recursive_mutex> lock(mutex);
+		stats.budget = bytes;
+	}
+
+	ResidencyStats getStats() const
+	{
+		std::lock_guard<std::recursive_mutex> lock(mutex);
+		return stats;
+	}
+private:
+	Residency(const Residency&);
+	Residency& operator=(const Residency&);
+
+	typedef std::chrono::steady_clock Clock;
+
+	void erase(Entry &e)
+	{
+		if(e.resident)
+			stats.resident_bytes -= e.bytes;
+		entries.erase(e.self);
+	}
+
+	void touchLocked(Entry &e, cl_command_queue queue)
+	{
+		e.epoch = epoch;
+		entries.splice(entries.end(), entries, e.self);
+		if(!e.resident)
+			restore(e, queue);
+	}
+
+	cl_mem allocate(Entry &e, cl_mem_flags flags, void *source, cl_command_queue queue)
+	{
+		makeRoom(e.bytes, queue);
+		for(;;)
+		{
+			cl_int error;
+			cl_mem mem = clCreateBuffer(context, flags, e.bytes, source, &error);
+			if(error == CL_SUCCESS)
+				return mem;
+			if((error != CL_MEM_OBJECT_ALLOCATION_FAILURE && error != CL_OUT_OF_RESOURCES) || !evictOne(queue))
+				checkError(error);
+		}
+	}
+
+	void restore(Entry &e, cl_command_queue queue)
+	{
+		const Clock::time_point start = Clock::now();
+		*e.mem = allocate(e, e.flags, 0, queue);
+		// blocking, so the backing storage can be freed right away
+		cl_int error = clEnqueueWriteBuffer(queue, *e.mem, CL_TRUE, 0, e.bytes, e.backing.data(), 0, 0, 0);
+		if(error != CL_SUCCESS)
+		{
+			clReleaseMemObject(*e.mem);
+			*e.mem = 0;
+			checkError(error);
+		}
+		std::vector<char>().swap(e.backing);
+		e.resident = true;
+		stats.resident_bytes += e.bytes;
+		stats.peak_resident_bytes = std::max(stats.peak_resident_bytes, stats.resident_bytes);
+		++stats.restores;
+		stats.bytes_restored += e.bytes;
+		stats.stall_seconds += std::chrono::duration<double>(Clock::now() - start).count();
+	}
+
+	// evicts until bytes more fit into the budget or nothing is left to
+	// evict, in which case the allocation is attempted anyway
+	void makeRoom(size_t bytes, cl_command_queue queue)
+	{
+		while(stats.resident_bytes + bytes > stats.budget && evictOne(queue))
+			;
+	}
+
+	bool evictOne(cl_command_queue queue)
+	{
+		for(std::list<Entry>::iterator i = entries.begin();i!=entries.end();++i)
+			if(i->resident && i->pins == 0 && i->epoch != epoch)
+			{
+				evict(*i, queue);
+				return true;
+			}
+		return false;
+	}
+
+	void evict(Entry &e, cl_command_queue queue)
+	{
+		const Clock::time_point start = Clock::now();
+		// commands on other queues, or later ones on an out of order
+		// queue, may still use the buffer
+		for(size_t i = 0;i<queues.size();++i)
+			checkError(clFinish(queues[i]));
+		e.backing.resize(e.bytes);
+		checkError(clEnqueueReadBuffer(queue, *e.mem, CL_TRUE, 0, e.bytes, e.backing.data(), 0, 0, 0));
+		checkError(clReleaseMemObject(*e.mem));
+		*e.mem = 0;
+		e.resident = false;
+		stats.resident_bytes -= e.bytes;
+		++stats.evictions;
+		stats.bytes_evicted += e.bytes;
+		stats.stall_seconds += std::chrono::duration<double>(Clock::now() - start).count();
+	}
+
+	cl_context context;
+	std::vector<cl_command_queue> queues;
+	cl_ulong epoch;
+	// least recently used first
+	std::list<Entry> entries;
+	ResidencyStats stats;
+	// recursive, binding arguments touches buffers under a Launch
+	mutable std::recursive_mutex mutex;
+};
+
+}
+
+#endif
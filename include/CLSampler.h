@@ -0,0 +1,50 @@
+#ifndef CL_SAMPLER_H
+#define CL_SAMPLER_H
+
+#include "CLContext.h"
+
+namespace clp
+{
+
+class Sampler {
+public:
+	Sampler(const Context &c, cl_bool normalized = CL_FALSE, cl_addressing_mode addressing = CL_ADDRESS_CLAMP_TO_EDGE, cl_filter_mode filter = CL_FILTER_NEAREST)
+		: sampler(c.getSampler(normalized, addressing, filter)), normalized_(normalized), addressing_(addressing), filter_(filter)
+	{
+		checkError(clRetainSampler(sampler));
+	}
+	Sampler(const Sampler &s) : sampler(s.sampler), normalized_(s.normalized_), addressing_(s.addressing_), filter_(s.filter_)
+	{
+		checkError(clRetainSampler(sampler));
+	}
+	Sampler& operator=(const Sampler &s)
+	{
+		checkError(clRetainSampler(s.sampler));
+		clReleaseSampler(sampler);
+		sampler = s.sampler;
+		normalized_ = s.normalized_;
+		addressing_ = s.addressing_;
+		filter_ = s.filter_;
+		return *this;
+	}
+	
+	cl_bool normalized() const { return normalized_; }
+	cl_addressing_mode addressing() const { return addressing_; }
+	cl_filter_mode filter() const { return filter_; }
+	
+	const cl_sampler* getSampler() const { return &sampler; }
+	
+	~Sampler()
+	{
+		clReleaseSampler(sampler);
+	}
+private:
+	cl_sampler sampler;
+	cl_bool normalized_;
+	cl_addressing_mode addressing_;
+	cl_filter_mode filter_;
+};
+
+}
+
+#endif
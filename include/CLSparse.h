@@ -0,0 +1,572 @@
+#ifndef CL_SPARSE_H
+#define CL_SPARSE_H
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "CLEvent.h"
+#include "CLContext.h"
+#include "CLBuffer.h"
+#include "CLProgram.h"
+
+namespace clp {
+
+// Host side matrix in coordinate form, the input of the device formats.
+// Duplicate entries are summed when converting.
+template<class T>
+class CooMatrix {
+public:
+	CooMatrix(cl_uint r, cl_uint c)
+		: rows(r), columns(c)
+	{
+		if(rows == 0 || columns == 0)
+			throw std::runtime_error("empty sparse matrix");
+	}
+
+	void add(cl_uint row, cl_uint column, T value)
+	{
+		if(row >= rows || column >= columns)
+			throw std::runtime_error("sparse matrix index out of range");
+		row_index.push_back(row);
+		column_index.push_back(column);
+		values.push_back(value);
+	}
+
+	void reserve(size_t nonzeros)
+	{
+		row_index.reserve(nonzeros);
+		column_index.reserve(nonzeros);
+		values.reserve(nonzeros);
+	}
+
+	cl_uint getRows() const { return rows; }
+	cl_uint getColumns() const { return columns; }
+	size_t getEntries() const { return values.size(); }
+	const std::vector<cl_uint>& getRowIndex() const { return row_index; }
+	const std::vector<cl_uint>& getColumnIndex() const { return column_index; }
+	const std::vector<T>& getValues() const { return values; }
+private:
+	cl_uint rows, columns;
+	std::vector<cl_uint> row_index, column_index;
+	std::vector<T> values;
+};
+
+// distribution of the nonzeros per row, which decides the kernel strategy
+struct RowStats {
+	cl_uint max_length;
+	double mean_length;
+	double deviation;
+};
+
+namespace detail {
+
+template<class T>
+struct HostCsr {
+	std::vector<cl_uint> offsets, columns;
+	std::vector<T> values;
+};
+
+// rows by counting sort, columns sorted and merged within each row
+template<class T>
+void toCsr(const CooMatrix<T> &coo, HostCsr<T> &csr)
+{
+	const std::vector<cl_uint> &row_index = coo.getRowIndex();
+	const std::vector<cl_uint> &column_index = coo.getColumnIndex();
+	const std::vector<T> &values = coo.getValues();
+	if(values.size() > 0xffffffffu)
+		throw std::runtime_error("too many nonzeros");
+
+	std::vector<cl_uint> position(coo.getRows() + 1, 0);
+	for(size_t i = 0;i<row_index.size();++i)
+		++position[row_index[i] + 1];
+	for(size_t r = 0;r<coo.getRows();++r)
+		position[r + 1] += position[r];
+	std::vector< std::pair<cl_uint, T> > entries(values.size());
+	for(size_t i = 0;i<values.size();++i)
+		entries[position[row_index[i]]++] = std::make_pair(column_index[i], values[i]);
+
+	csr.offsets.assign(1, 0);
+	csr.offsets.reserve(coo.getRows() + 1);
+	csr.columns.clear();
+	csr.values.clear();
+	size_t begin = 0;
+	for(size_t r = 0;r<coo.getRows();++r)
+	{
+		const size_t end = position[r];
+		std::sort(entries.begin() + begin, entries.begin() + end,
+			[](const std::pair<cl_uint, T> &a, const std::pair<cl_uint, T> &b) { return a.first < b.first; });
+		for(size_t i = begin;i<end;++i)
+		{
+			if(csr.columns.size() > csr.offsets.back() && csr.columns.back() == entries[i].first)
+				csr.values.back() += entries[i].second;
+			else
+			{
+				csr.columns.push_back(entries[i].first);
+				csr.values.push_back(entries[i].second);
+			}
+		}
+		csr.offsets.push_back(cl_uint(csr.columns.size()));
+		begin = end;
+	}
+}
+
+inline RowStats rowStats(const std::vector<cl_uint> &offsets)
+{
+	const size_t rows = offsets.size() - 1;
+	RowStats s = RowStats();
+	s.mean_length = double(offsets.back())/rows;
+	double squares = 0;
+	for(size_t r = 0;r<rows;++r)
+	{
+		const cl_uint length = offsets[r + 1] - offsets[r];
+		s.max_length = std::max(s.max_length, length);
+		squares += (length - s.mean_length)*(length - s.mean_length);
+	}
+	s.deviation = std::sqrt(squares/rows);
+	return s;
+}
+
+// Rows, columns and row statistics shared by the device formats. Device
+// arrays have at least one element, since buffers cannot be empty.
+template<class T>
+class SparseShape {
+public:
+	cl_uint getRows() const { return rows; }
+	cl_uint getColumns() const { return columns; }
+	size_t getNonzeros() const { return nonzeros; }
+	const RowStats& getRowStats() const { return stats; }
+protected:
+	SparseShape(const CooMatrix<T> &coo, HostCsr<T> &csr)
+		: rows(coo.getRows()), columns(coo.getColumns())
+	{
+		toCsr(coo, csr);
+		nonzeros = csr.values.size();
+		stats = rowStats(csr.offsets);
+	}
+
+	static size_t allocated(size_t n) { return std::max<size_t>(n, 1); }
+
+	cl_uint rows, columns;
+	size_t nonzeros;
+	RowStats stats;
+};
+
+}
+
+// Compressed sparse rows: row offsets, column indices and values. Products
+// use one work item per row (lanes == 1) or a vector of lanes work items
+// sharing a row, picked from the row lengths: short rows favour a work item
+// per row, long or very uneven rows, as in power law graphs, are split
+// over lanes so no work item walks a hub row alone.
+template<class T>
+class CsrMatrix : public detail::SparseShape<T> {
+public:
+	CsrMatrix(const Context &context, const CooMatrix<T> &coo)
+		: CsrMatrix(context, coo, detail::HostCsr<T>())
+	{
+	}
+
+	// 1 is one work item per row, otherwise a power of two up to 32
+	size_t getLanes() const { return lanes; }
+	void setLanes(size_t l)
+	{
+		if(l == 0 || l > 32 || (l & (l - 1)))
+			throw std::runtime_error("lanes have to be a power of two up to 32");
+		lanes = l;
+	}
+
+	// Lanes for rows of the given length distribution. Short rows of
+	// similar length get one work item per row. Otherwise the lanes cover
+	// a row one deviation above the mean in one pass, so long rows and
+	// uneven ones, where hub rows would keep single work items busy, are
+	// shared.
+	static size_t chooseLanes(const RowStats &s)
+	{
+		const bool short_rows = s.mean_length <= 16 && s.max_length < 32;
+		const bool even = s.deviation <= s.mean_length/2;
+		if(short_rows && even)
+			return 1;
+		const double length = s.mean_length + s.deviation;
+		size_t l = 2;
+		while(l < 32 && l < length)
+			l *= 2;
+		return l;
+	}
+
+	const Buffer<cl_uint>& getOffsets() const { return offsets; }
+	const Buffer<cl_uint>& getColumnIndex() const { return column_index; }
+	const Buffer<T>& getValues() const { return values; }
+private:
+	CsrMatrix(const Context &context, const CooMatrix<T> &coo, detail::HostCsr<T> &&csr)
+		: detail::SparseShape<T>(coo, csr),
+		offsets(context, csr.offsets.size()),
+		column_index(context, this->allocated(csr.columns.size())),
+		values(context, this->allocated(csr.values.size()))
+	{
+		lanes = chooseLanes(this->stats);
+		Event e = offsets.write(csr.offsets.data());
+		if(this->nonzeros)
+		{
+			column_index.writeRange(0, this->nonzeros, csr.columns.data());
+			e = values.writeRange(0, this->nonzeros, csr.values.data());
+		}
+		// csr is gone after the constructor
+		e.wait();
+	}
+
+	size_t lanes;
+	Buffer<cl_uint> offsets;
+	Buffer<cl_uint> column_index;
+	Buffer<T> values;
+};
+
+// ELLPACK: every row padded to the longest one and stored column major,
+// so neighbouring work items read neighbouring entries. Best for rows of
+// similar length, the padding grows with the longest row.
+template<class T>
+class EllMatrix : public detail::SparseShape<T> {
+public:
+	EllMatrix(const Context &context, const CooMatrix<T> &coo)
+		: EllMatrix(context, coo, detail::HostCsr<T>())
+	{
+	}
+
+	cl_uint getWidth() const { return width; }
+
+	const Buffer<cl_uint>& getColumnIndex() const { return column_index; }
+	const Buffer<T>& getValues() const { return values; }
+private:
+	EllMatrix(const Context &context, const CooMatrix<T> &coo, detail::HostCsr<T> &&csr)
+		: detail::SparseShape<T>(coo, csr),
+		width(this->stats.max_length),
+		column_index(context, this->allocated(checkedSize(size_t(this->rows)*width))),
+		values(context, this->allocated(size_t(this->rows)*width))
+	{
+		// padding repeats column 0 with a zero value
+		const size_t n = size_t(this->rows)*width;
+		std::vector<cl_uint> c(this->allocated(n), 0);
+		std::vector<T> v(this->allocated(n), T(0));
+		for(size_t r = 0;r<this->rows;++r)
+			for(cl_uint i = csr.offsets[r];i<csr.offsets[r + 1];++i)
+			{
+				const size_t index = (i - csr.offsets[r])*size_t(this->rows) + r;
+				c[index] = csr.columns[i];
+				v[index] = csr.values[i];
+			}
+		column_index.write(c.data());
+		values.write(v.data()).wait();
+	}
+
+	static size_t checkedSize(size_t n)
+	{
+		if(n > 0xffffffffu)
+			throw std::runtime_error("ELL matrix too large, use SlicedEllMatrix");
+		return n;
+	}
+
+	cl_uint width;
+	Buffer<cl_uint> column_index;
+	Buffer<T> values;
+};
+
+// Sliced ELLPACK: ELL per slice of slice_height consecutive rows, each
+// padded only to its own longest row. Keeps the coalesced layout of ELL
+// while a few long rows only pad their own slices.
+template<class T>
+class SlicedEllMatrix : public detail::SparseShape<T> {
+public:
+	SlicedEllMatrix(const Context &context, const CooMatrix<T> &coo, cl_uint slice_height = 32)
+		: SlicedEllMatrix(context, coo, slice_height, detail::HostCsr<T>())
+	{
+	}
+
+	cl_uint getSliceHeight() const { return height; }
+	// stored entries including padding
+	size_t getStoredEntries() const { return stored; }
+
+	const Buffer<cl_uint>& getSliceOffsets() const { return slice_offsets; }
+	const Buffer<cl_uint>& getColumnIndex() const { return column_index; }
+	const Buffer<T>& getValues() const { return values; }
+private:
+	SlicedEllMatrix(const Context &context, const CooMatrix<T> &coo, cl_uint slice_height, detail::HostCsr<T> &&csr)
+		: detail::SparseShape<T>(coo, csr),
+		height(slice_height ? slice_height : throw std::runtime_error("slice height has to be positive")),
+		stored(layout(csr)),
+		slice_offsets(context, offsets.size()),
+		column_index(context, this->allocated(stored)),
+		values(context, this->allocated(stored))
+	{
+		std::vector<cl_uint> c(this->allocated(stored), 0);
+		std::vector<T> v(this->allocated(stored), T(0));
+		for(size_t r = 0;r<this->rows;++r)
+		{
+			const size_t begin = offsets[r/height];
+			for(cl_uint i = csr.offsets[r];i<csr.offsets[r + 1];++i)
+			{
+				const size_t index = begin + (i - csr.offsets[r])*size_t(height) + r % height;
+				c[index] = csr.columns[i];
+				v[index] = csr.values[i];
+			}
+		}
+		slice_offsets.write(offsets.data());
+		column_index.write(c.data());
+		values.write(v.data()).wait();
+	}
+
+	// slice offsets into offsets, returns the stored entries
+	size_t layout(const detail::HostCsr<T> &csr)
+	{
+		const size_t slices = (this->rows + height - 1)/height;
+		offsets.assign(1, 0);
+		size_t n = 0;
+		for(size_t s = 0;s<slices;++s)
+		{
+			cl_uint longest = 0;
+			for(size_t r = s*height;r<std::min<size_t>((s + 1)*height, this->rows);++r)
+				longest = std::max(longest, csr.offsets[r + 1] - csr.offsets[r]);
+			n += size_t(longest)*height;
+			if(n > 0xffffffffu)
+				throw std::runtime_error("sliced ELL matrix too large");
+			offsets.push_back(cl_uint(n));
+		}
+		return n;
+	}
+
+	cl_uint height;
+	std::vector<cl_uint> offsets;
+	size_t stored;
+	Buffer<cl_uint> slice_offsets;
+	Buffer<cl_uint> column_index;
+	Buffer<T> values;
+};
+
+// Sparse matrix products y = A*x (spmv) and Y = A*X (spmm) with dense row
+// major X (columns x k) and Y (rows x k), T is cl_float or cl_double. X
+// and Y are indexed with size_t, so columns*k and rows*k may exceed 2^32.
+// CSR products follow the matrix's lanes, ELL and sliced ELL use one work
+// item per row. Like Kernel, a Sparse object must only be used by one
+// thread at a time.
+template<class T>
+class Sparse {
+public:
+	static_assert(std::is_same<T, cl_float>::value || std::is_same<T, cl_double>::value, "Sparse needs cl_float or cl_double values");
+
+	Sparse(const Context &c)
+		: program(c), context(c)
+	{
+		group = 1;
+		while(group*2 <= std::min<size_t>(context.getDeviceInfo().max_work_group_size, 256))
+			group *= 2;
+
+		program.setSource(source());
+		program.build();
+		scalar_kernel.reset(new CsrKernel(program.getKernel<CsrSignature>("csr_scalar")));
+		vector_kernel.reset(new CsrVectorKernel(program.getKernel<CsrVectorSignature>("csr_vector")));
+		ell_kernel.reset(new EllKernel(program.getKernel<EllSignature>("ell")));
+		sell_kernel.reset(new SellKernel(program.getKernel<SellSignature>("sliced_ell")));
+	}
+
+	template<class M>
+	Event spmv(const M &A, const Buffer<T> &x, Buffer<T> &y)
+	{
+		return spmm(1, A, x, y, 0, 0);
+	}
+
+	template<class M>
+	Event spmv(const M &A, const Buffer<T> &x, Buffer<T> &y, const Event &event)
+	{
+		return spmm(1, A, x, y, 1, event.getEventPtr());
+	}
+
+	template<class M>
+	Event spmv(const M &A, const Buffer<T> &x, Buffer<T> &y, cl_uint event_count, const cl_event *events)
+	{
+		return spmm(1, A, x, y, event_count, events);
+	}
+
+	template<class M>
+	Event spmm(cl_uint k, const M &A, const Buffer<T> &X, Buffer<T> &Y)
+	{
+		return spmm(k, A, X, Y, 0, 0);
+	}
+
+	template<class M>
+	Event spmm(cl_uint k, const M &A, const Buffer<T> &X, Buffer<T> &Y, const Event &event)
+	{
+		return spmm(k, A, X, Y, 1, event.getEventPtr());
+	}
+
+	template<class M>
+	Event spmm(cl_uint k, const M &A, const Buffer<T> &X, Buffer<T> &Y, cl_uint event_count, const cl_event *events)
+	{
+		if(k == 0)
+			throw std::runtime_error("spmm needs at least one column");
+		checkSize(X, size_t(A.getColumns())*k);
+		checkSize(Y, size_t(A.getRows())*k);
+		return launch(A, k, input(X), Y, event_count, events);
+	}
+private:
+	typedef void CsrSignature(cl_uint, cl_uint, cl_uint*, cl_uint*, T*, T*, T*);
+	typedef void CsrVectorSignature(cl_uint, cl_uint, cl_uint*, cl_uint*, T*, T*, T*, Local<T>);
+	typedef void EllSignature(cl_uint, cl_uint, cl_uint, cl_uint*, T*, T*, T*);
+	typedef void SellSignature(cl_uint, cl_uint, cl_uint, cl_uint*, cl_uint*, T*, T*, T*);
+	typedef Kernel<CsrSignature> CsrKernel;
+	typedef Kernel<CsrVectorSignature> CsrVectorKernel;
+	typedef Kernel<EllSignature> EllKernel;
+	typedef Kernel<SellSignature> SellKernel;
+
+	Sparse(const Sparse&);
+	Sparse& operator=(const Sparse&);
+
+	// the kernels only read their inputs, Kernel just has no const buffer arguments
+	template<class U>
+	static Buffer<U>& input(const Buffer<U> &b) { return const_cast<Buffer<U>&>(b); }
+
+	static size_t roundUp(size_t n, size_t multiple)
+	{
+		return (n + multiple - 1)/multiple*multiple;
+	}
+
+	static void checkSize(const Buffer<T> &b, size_t n)
+	{
+		if(b.size() < n)
+			throw std::runtime_error("buffer too short");
+	}
+
+	Event launch(const CsrMatrix<T> &A, cl_uint k, Buffer<T> &X, Buffer<T> &Y, cl_uint event_count, const cl_event *events)
+	{
+		const size_t lanes = std::min(A.getLanes(), group);
+		if(lanes == 1)
+		{
+			const Worksize ws(roundUp(A.getRows(), group), group);
+			return (*scalar_kernel)(ws, A.getRows(), k, input(A.getOffsets()), input(A.getColumnIndex()), input(A.getValues()), X, Y, event_count, events);
+		}
+		const size_t rows_per_group = group/lanes;
+		const Worksize ws(lanes, roundUp(A.getRows(), rows_per_group), lanes, rows_per_group);
+		return (*vector_kernel)(ws, A.getRows(), k, input(A.getOffsets()), input(A.getColumnIndex()), input(A.getValues()), X, Y, Local<T>(group), event_count, events);
+	}
+
+	Event launch(const EllMatrix<T> &A, cl_uint k, Buffer<T> &X, Buffer<T> &Y, cl_uint event_count, const cl_event *events)
+	{
+		const Worksize ws(roundUp(A.getRows(), group), group);
+		return (*ell_kernel)(ws, A.getRows(), k, A.getWidth(), input(A.getColumnIndex()), input(A.getValues()), X, Y, event_count, events);
+	}
+
+	Event launch(const SlicedEllMatrix<T> &A, cl_uint k, Buffer<T> &X, Buffer<T> &Y, cl_uint event_count, const cl_event *events)
+	{
+		const Worksize ws(roundUp(A.getRows(), group), group);
+		return (*sell_kernel)(ws, A.getRows(), k, A.getSliceHeight(), input(A.getSliceOffsets()), input(A.getColumnIndex()), input(A.getValues()), X, Y, event_count, events);
+	}
+
+	std::string source() const
+	{
+		std::ostringstream defines;
+		if(std::is_same<T, cl_double>::value)
+			defines << "#pragma OPENCL EXTENSION cl_khr_fp64 : enable\n";
+		defines << "#define T " << type2name<T>::name() << "\n";
+		return defines.str() +
+		"\n"
+		"kernel void csr_scalar(const uint rows, const uint k, global const uint *offsets,\n"
+		"	global const uint *columns, global const T *values, global const T *X, global T *Y)\n"
+		"{\n"
+		"	const uint row = get_global_id(0);\n"
+		"	if(row >= rows)\n"
+		"		return;\n"
+		"	const uint begin = offsets[row];\n"
+		"	const uint end = offsets[row + 1];\n"
+		"	for(uint j = 0;j<k;++j)\n"
+		"	{\n"
+		"		T acc = 0;\n"
+		"		for(uint i = begin;i<end;++i)\n"
+		"			acc += values[i]*X[(size_t)columns[i]*k + j];\n"
+		"		Y[(size_t)row*k + j] = acc;\n"
+		"	}\n"
+		"}\n"
+		"\n"
+		"// the lanes of a row (dimension 0) stride over its entries and add\n"
+		"// their partial sums in local memory\n"
+		"kernel void csr_vector(const uint rows, const uint k, global const uint *offsets,\n"
+		"	global const uint *columns, global const T *values, global const T *X, global T *Y,\n"
+		"	local T *partial)\n"
+		"{\n"
+		"	const uint lane = get_local_id(0);\n"
+		"	const uint lanes = get_local_size(0);\n"
+		"	local T *sum = partial + get_local_id(1)*lanes;\n"
+		"	const uint row = get_global_id(1);\n"
+		"	const uint begin = row < rows ? offsets[row] : 0;\n"
+		"	const uint end = row < rows ? offsets[row + 1] : 0;\n"
+		"	for(uint j = 0;j<k;++j)\n"
+		"	{\n"
+		"		T acc = 0;\n"
+		"		for(uint i = begin + lane;i<end;i+=lanes)\n"
+		"			acc += values[i]*X[(size_t)columns[i]*k + j];\n"
+		"		sum[lane] = acc;\n"
+		"		barrier(CLK_LOCAL_MEM_FENCE);\n"
+		"		for(uint s = lanes/2;s>0;s>>=1)\n"
+		"		{\n"
+		"			if(lane < s)\n"
+		"				sum[lane] += sum[lane + s];\n"
+		"			barrier(CLK_LOCAL_MEM_FENCE);\n"
+		"		}\n"
+		"		if(lane == 0 && row < rows)\n"
+		"			Y[(size_t)row*k + j] = sum[0];\n"
+		"		barrier(CLK_LOCAL_MEM_FENCE);\n"
+		"	}\n"
+		"}\n"
+		"\n"
+		"kernel void ell(const uint rows, const uint k, const uint width,\n"
+		"	global const uint *columns, global const T *values, global const T *X, global T *Y)\n"
+		"{\n"
+		"	const uint row = get_global_id(0);\n"
+		"	if(row >= rows)\n"
+		"		return;\n"
+		"	for(uint j = 0;j<k;++j)\n"
+		"	{\n"
+		"		T acc = 0;\n"
+		"		for(uint n = 0;n<width;++n)\n"
+		"		{\n"
+		"			const size_t index = (size_t)n*rows + row;\n"
+		"			acc += values[index]*X[(size_t)columns[index]*k + j];\n"
+		"		}\n"
+		"		Y[(size_t)row*k + j] = acc;\n"
+		"	}\n"
+		"}\n"
+		"\n"
+		"kernel void sliced_ell(const uint rows, const uint k, const uint height,\n"
+		"	global const uint *slice_offsets, global const uint *columns, global const T *values,\n"
+		"	global const T *X, global T *Y)\n"
+		"{\n"
+		"	const uint row = get_global_id(0);\n"
+		"	if(row >= rows)\n"
+		"		return;\n"
+		"	const uint slice = row/height;\n"
+		"	const uint begin = slice_offsets[slice] + row % height;\n"
+		"	const uint end = slice_offsets[slice + 1];\n"
+		"	for(uint j = 0;j<k;++j)\n"
+		"	{\n"
+		"		T acc = 0;\n"
+		"		for(uint index = begin;index<end;index+=height)\n"
+		"			acc += values[index]*X[(size_t)columns[index]*k + j];\n"
+		"		Y[(size_t)row*k + j] = acc;\n"
+		"	}\n"
+		"}\n";
+	}
+
+	size_t group;
+	Program program;
+	std::unique_ptr<CsrKernel> scalar_kernel;
+	std::unique_ptr<CsrVectorKernel> vector_kernel;
+	std::unique_ptr<EllKernel> ell_kernel;
+	std::unique_ptr<SellKernel> sell_kernel;
+	Context context;
+};
+
+}
+
+#endif
@@ -0,0 +1,342 @@
+#ifndef CL_STENCIL_H
+#define CL_STENCIL_H
+
+#include <algorithm>
+#include <cstdlib>
+#include <iomanip>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <type_traits>
+#include <vector>
+
+#include "CLEvent.h"
+#include "CLContext.h"
+#include "CLBuffer.h"
+#include "CLImage.h"
+#include "CLProgram.h"
+
+namespace clp {
+
+// Weights of a (2*radius_x+1) x (2*radius_y+1) window centered on the
+// output element, stored row by row.
+class Footprint {
+public:
+	Footprint(size_t radius_x, size_t radius_y, const std::vector<double> &coefficients)
+		: rx(radius_x), ry(radius_y), c(coefficients)
+	{
+		if(c.size() != (2*rx + 1)*(2*ry + 1))
+			throw std::runtime_error("footprint size does not match its radius");
+	}
+
+	// footprint fixed at compile time, both extents have to be odd
+	template<class V, size_t H, size_t W>
+	Footprint(const V (&coefficients)[H][W])
+		: rx(W/2), ry(H/2)
+	{
+		static_assert(H % 2 == 1 && W % 2 == 1, "footprint extents have to be odd");
+		for(size_t y = 0;y<H;++y)
+			for(size_t x = 0;x<W;++x)
+				c.push_back(coefficients[y][x]);
+	}
+
+	static Footprint row(const std::vector<double> &coefficients)
+	{
+		return Footprint(coefficients.size()/2, 0, coefficients);
+	}
+
+	static Footprint column(const std::vector<double> &coefficients)
+	{
+		return Footprint(0, coefficients.size()/2, coefficients);
+	}
+
+	size_t radiusX() const { return rx; }
+	size_t radiusY() const { return ry; }
+	double operator()(int dx, int dy) const { return c[(dy + ry)*(2*rx + 1) + dx + rx]; }
+private:
+	size_t rx, ry;
+	std::vector<double> c;
+};
+
+// Applies a stencil to 2D grids with clamp to edge borders. A work-group
+// loads its tile plus halo into local memory once and runs all stages of
+// up to steps iterations there (temporal blocking), so global memory is
+// touched once per launch instead of once per stage and iteration.
+// Intermediate values stay in float (double for cl_double) within a
+// launch. Grids live in pitched Buffer<T> or scalar Image2D<T>; input and
+// output must be different objects. Like Kernel, a Stencil must only be
+// used by one thread at a time.
+template<class T>
+class Stencil {
+public:
+	static_assert(std::is_arithmetic<T>::value, "Stencil needs scalar grid elements");
+
+	Stencil(const Context &c, const Footprint &footprint, size_t steps = 1)
+		: program(c), context(c)
+	{
+		stages.push_back(footprint);
+		create(steps);
+	}
+
+	// separable filter, a row pass followed by a column pass per iteration
+	Stencil(const Context &c, const std::vector<double> &row, const std::vector<double> &column, size_t steps = 1)
+		: program(c), context(c)
+	{
+		stages.push_back(Footprint::row(row));
+		stages.push_back(Footprint::column(column));
+		create(steps);
+	}
+
+	// width x height grid whose rows are pitch elements apart (0 is width)
+	Event apply(const Buffer<T> &in, Buffer<T> &out, size_t width, size_t height, size_t pitch = 0, size_t iterations = 1)
+	{
+		return apply(in, out, width, height, pitch, iterations, 0, 0);
+	}
+
+	Event apply(const Buffer<T> &in, Buffer<T> &out, size_t width, size_t height, size_t pitch, size_t iterations, const Event &event)
+	{
+		return apply(in, out, width, height, pitch, iterations, 1, event.getEventPtr());
+	}
+
+	Event apply(const Buffer<T> &in, Buffer<T> &out, size_t width, size_t height, size_t pitch, size_t iterations, cl_uint event_count, const cl_event *events)
+	{
+		if(pitch == 0)
+			pitch = width;
+		checkIterations(iterations);
+		if(width == 0 || height == 0 || pitch < width || in.size() < pitch*height || out.size() < pitch*height)
+			throw std::runtime_error("buffer too short");
+		if(launches(iterations) > 1 && (!temp_buffer || temp_buffer->size() < pitch*height))
+			temp_buffer.reset(new Buffer<T>(context, pitch*height));
+		const Worksize ws(roundUp(width), roundUp(height), tile, tile);
+		Buffer<T> *src = &const_cast<Buffer<T>&>(in);
+		Event event;
+		for(size_t i = 0, n = launches(iterations);i<n;++i)
+		{
+			Buffer<T> *dst = (n - 1 - i) % 2 ? temp_buffer.get() : &out;
+			const cl_uint s = cl_uint(std::min(steps, iterations - i*steps));
+			if(i == 0)
+				event = (*buffer_kernel)(ws, *src, *dst, cl_uint(width), cl_uint(height), cl_uint(pitch), s, event_count, events);
+			else
+				event = (*buffer_kernel)(ws, *src, *dst, cl_uint(width), cl_uint(height), cl_uint(pitch), s, event);
+			src = dst;
+		}
+		return event;
+	}
+
+	Event apply(const Image2D<T> &in, Image2D<T> &out, size_t iterations = 1)
+	{
+		return apply(in, out, iterations, 0, 0);
+	}
+
+	Event apply(const Image2D<T> &in, Image2D<T> &out, size_t iterations, const Event &event)
+	{
+		return apply(in, out, iterations, 1, event.getEventPtr());
+	}
+
+	Event apply(const Image2D<T> &in, Image2D<T> &out, size_t iterations, cl_uint event_count, const cl_event *events)
+	{
+		checkIterations(iterations);
+		if(!image_kernel)
+			throw std::runtime_error("device does not support images");
+		const size_t width = in.width(), height = in.height();
+		if(out.width() != width || out.height() != height)
+			throw std::runtime_error("image sizes differ");
+		if(launches(iterations) > 1 && (!temp_image || temp_image->width() != width || temp_image->height() != height))
+			temp_image.reset(new Image2D<T>(context, width, height));
+		const Worksize ws(roundUp(width), roundUp(height), tile, tile);
+		const Image2D<T> *src = &in;
+		Event event;
+		for(size_t i = 0, n = launches(iterations);i<n;++i)
+		{
+			Image2D<T> *dst = (n - 1 - i) % 2 ? temp_image.get() : &out;
+			const cl_uint s = cl_uint(std::min(steps, iterations - i*steps));
+			if(i == 0)
+				event = (*image_kernel)(ws, *src, *dst, cl_uint(width), cl_uint(height), s, event_count, events);
+			else
+				event = (*image_kernel)(ws, *src, *dst, cl_uint(width), cl_uint(height), s, event);
+			src = dst;
+		}
+		return event;
+	}
+
+	size_t getTileSize() const { return tile; }
+	size_t getSteps() const { return steps; }
+	const std::string& getSource() const { return program.getSource(); }
+private:
+	typedef typename std::conditional<std::is_same<T, cl_double>::value, cl_double, cl_float>::type accumulator;
+	typedef void BufferSignature(T*, T*, cl_uint, cl_uint, cl_uint, cl_uint);
+	typedef void ImageSignature(Image2D<T>, Image2D<T>, cl_uint, cl_uint, cl_uint);
+	typedef Kernel<BufferSignature> BufferKernel;
+	typedef Kernel<ImageSignature> ImageKernel;
+
+	Stencil(const Stencil&);
+	Stencil& operator=(const Stencil&);
+
+	void create(size_t s)
+	{
+		steps = std::max<size_t>(s, 1);
+		halo_x = halo_y = 0;
+		for(size_t i = 0;i<stages.size();++i)
+		{
+			halo_x += steps*stages[i].radiusX();
+			halo_y += steps*stages[i].radiusY();
+		}
+
+		const DeviceInfo &info = context.getDeviceInfo();
+
+		for(tile = 16;tile >= 4;tile /= 2)
+			if(tile*tile <= info.max_work_group_size && 2*(tile + 2*halo_x)*(tile + 2*halo_y)*sizeof(accumulator) <= info.local_memory_size)
+				break;
+		if(tile < 4)
+			throw std::runtime_error("stencil halo does not fit into local memory");
+
+		const bool image_kernels = info.image_support && !std::is_same<T, cl_double>::value;
+		program.setSource(source(image_kernels));
+		program.build();
+		buffer_kernel.reset(new BufferKernel(program.getKernel<BufferSignature>("stencil_buffer")));
+		if(image_kernels)
+			image_kernel.reset(new ImageKernel(program.getKernel<ImageSignature>("stencil_image")));
+	}
+
+	std::string source(bool image_kernels) const
+	{
+		const std::string type = type2name<T>::name();
+		const std::string acc = type2name<accumulator>::name();
+		std::ostringstream s;
+		if(std::is_same<T, cl_double>::value)
+			s << "#pragma OPENCL EXTENSION cl_khr_fp64 : enable\n";
+		s << "#define T " << type << "\n";
+		s << "#define ACC " << acc << "\n";
+		s << "#define TILE " << tile << "\n";
+		s << "#define HX " << halo_x << "\n";
+		s << "#define HY " << halo_y << "\n";
+		s << "#define LW (TILE + 2*HX)\n";
+		s << "#define LH (TILE + 2*HY)\n";
+		if(std::is_floating_point<T>::value)
+			s << "#define STORE(v) ((T)(v))\n";
+		else
+			s << "#define STORE(v) convert_" << type << "_sat_rte(v)\n";
+		s << "\n";
+
+		s << "kernel void stencil_buffer(global const T *in, global T *out, const uint width, const uint height, const uint pitch, const uint steps)\n";
+		s << body("in[y*pitch + x]", "out[y*pitch + x] = STORE(v)");
+		if(image_kernels)
+		{
+			std::string read = "read_imagef", write = "write_imagef(out, (int2)(x, y), (float4)(v))";
+			if(std::is_integral<T>::value && std::is_signed<T>::value)
+				read = "read_imagei", write = "write_imagei(out, (int2)(x, y), (int4)(STORE(v)))";
+			else if(std::is_integral<T>::value)
+				read = "read_imageui", write = "write_imageui(out, (int2)(x, y), (uint4)(STORE(v)))";
+			s << "\n";
+			s << "constant sampler_t clamped = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP_TO_EDGE | CLK_FILTER_NEAREST;\n\n";
+			s << "kernel void stencil_image(read_only image2d_t in, write_only image2d_t out, const uint width, const uint height, const uint steps)\n";
+			s << body("(ACC)" + read + "(in, clamped, (int2)(x, y)).x", write);
+		}
+		return s.str();
+	}
+
+	// load reads the element at x, y of the input, store writes the ACC v
+	// to x, y of the output
+	std::string body(const std::string &load, const std::string &store) const
+	{
+		std::ostringstream s;
+		s << "{\n"
+			"	local ACC tile_a[LW*LH];\n"
+			"	local ACC tile_b[LW*LH];\n"
+			"	const int x0 = (int)get_group_id(0)*TILE - HX;\n"
+			"	const int y0 = (int)get_group_id(1)*TILE - HY;\n"
+			"	const int lid = (int)(get_local_id(1)*TILE + get_local_id(0));\n"
+			"	for(int i = lid;i<LW*LH;i += TILE*TILE)\n"
+			"	{\n"
+			"		const int x = clamp(x0 + i%LW, 0, (int)width - 1);\n"
+			"		const int y = clamp(y0 + i/LW, 0, (int)height - 1);\n"
+			"		tile_a[i] = " << load << ";\n"
+			"	}\n"
+			"	barrier(CLK_LOCAL_MEM_FENCE);\n"
+			"	local ACC *src = tile_a;\n"
+			"	local ACC *dst = tile_b;\n"
+			"	int bx = 0, by = 0;\n"
+			"	for(uint step = 0;step<steps;++step)\n"
+			"	{\n";
+		for(size_t i = 0;i<stages.size();++i)
+			s << stage(stages[i]);
+		s << "	}\n"
+			"	const int x = x0 + HX + get_local_id(0);\n"
+			"	const int y = y0 + HY + get_local_id(1);\n"
+			"	if(x < (int)width && y < (int)height)\n"
+			"	{\n"
+			"		const ACC v = src[(HY + get_local_id(1))*LW + HX + get_local_id(0)];\n"
+			"		" << store << ";\n"
+			"	}\n"
+			"}\n";
+		return s.str();
+	}
+
+	// Computes the part of the tile that is still valid after this stage.
+	// Cells outside the grid take the value of the nearest border cell,
+	// which is what clamp to edge gives when iterating in global memory.
+	std::string stage(const Footprint &f) const
+	{
+		std::ostringstream s;
+		s << std::scientific << std::setprecision(std::numeric_limits<accumulator>::max_digits10);
+		const char *suffix = std::is_same<accumulator, cl_double>::value ? "" : "f";
+		const int rx = int(f.radiusX()), ry = int(f.radiusY());
+		if(rx)
+			s << "		bx += " << rx << ";\n";
+		if(ry)
+			s << "		by += " << ry << ";\n";
+		s << "		for(int i = lid;i<LW*LH;i += TILE*TILE)\n"
+			"		{\n"
+			"			const int lx = i%LW, ly = i/LW;\n"
+			"			if(lx < bx || lx >= LW - bx || ly < by || ly >= LH - by)\n"
+			"				continue;\n"
+			"			const int cx = clamp(x0 + lx, 0, (int)width - 1) - x0;\n"
+			"			const int cy = clamp(y0 + ly, 0, (int)height - 1) - y0;\n"
+			"			local const ACC *p = src + cy*LW + cx;\n"
+			"			ACC acc = 0;\n";
+		for(int dy = -ry;dy<=ry;++dy)
+			for(int dx = -rx;dx<=rx;++dx)
+				if(f(dx, dy) != 0)
+				{
+					s << "			acc += " << f(dx, dy) << suffix << "*p[";
+					if(dy)
+						s << dy << "*LW" << (dx < 0 ? " - " : " + ") << std::abs(dx) << "];\n";
+					else
+						s << dx << "];\n";
+				}
+		s << "			dst[i] = acc;\n"
+			"		}\n"
+			"		barrier(CLK_LOCAL_MEM_FENCE);\n"
+			"		{ local ACC *t = src; src = dst; dst = t; }\n";
+		return s.str();
+	}
+
+	static void checkIterations(size_t iterations)
+	{
+		if(iterations == 0)
+			throw std::runtime_error("stencil needs at least one iteration");
+	}
+
+	size_t launches(size_t iterations) const
+	{
+		return (iterations + steps - 1)/steps;
+	}
+
+	size_t roundUp(size_t n) const
+	{
+		return (n + tile - 1)/tile*tile;
+	}
+
+	std::vector<Footprint> stages;
+	size_t steps, tile, halo_x, halo_y;
+	Program program;
+	std::unique_ptr<BufferKernel> buffer_kernel;
+	std::unique_ptr<ImageKernel> image_kernel;
+	std::unique_ptr<Buffer<T> > temp_buffer;
+	std::unique_ptr<Image2D<T> > temp_image;
+	Context context;
+};
+
+}
+
+#endif
@@ -0,0 +1,329 @@
+#ifndef CL_STORAGE_H
+#define CL_STORAGE_H
+
+// Compact storage types for data that kernels compute on in float:
+// half precision and normalized integers. They are distinct host types,
+// so Buffer<half> and Image2D< unorm<cl_uchar4> > pick the right image
+// formats and kernel type names, while cl_half is just cl_ushort.
+//
+// In kernels, half buffers are accessed with vload_half/vstore_half (or
+// directly with cl_khr_fp16), normalized buffers hold their integer
+// storage type and images of both return floats from read_imagef.
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+
+#ifdef __F16C__
+#include <immintrin.h>
+#endif
+
+#define CL_USE_DEPRECATED_OPENCL_1_1_APIS
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "CLUtility.h"
+
+namespace clp
+{
+
+struct half {
+	cl_ushort bits;
+};
+
+struct alignas(4) half2 {
+	half s[2];
+};
+
+struct alignas(8) half4 {
+	half s[4];
+};
+
+// T is cl_uchar or cl_ushort (unorm), cl_char or cl_short (snorm), or
+// their 2 and 4 component vectors
+template<class T>
+struct unorm {
+	T value;
+};
+
+template<class T>
+struct snorm {
+	T value;
+};
+
+template<>
+struct type2format<half> {
+	static const cl_channel_type type = CL_HALF_FLOAT;
+	static const cl_channel_order order = CL_R;
+};
+
+template<>
+struct type2format<half2> {
+	static const cl_channel_type type = CL_HALF_FLOAT;
+	static const cl_channel_order order = CL_RG;
+};
+
+template<>
+struct type2format<half4> {
+	static const cl_channel_type type = CL_HALF_FLOAT;
+	static const cl_channel_order order = CL_RGBA;
+};
+
+template<class T>
+struct type2format< unorm<T> > {
+	static_assert(type2format<T>::type == CL_UNSIGNED_INT8 || type2format<T>::type == CL_UNSIGNED_INT16, "unorm needs 8 or 16 bit unsigned storage");
+	static const cl_channel_type type = type2format<T>::type == CL_UNSIGNED_INT8 ? CL_UNORM_INT8 : CL_UNORM_INT16;
+	static const cl_channel_order order = type2format<T>::order;
+};
+
+template<class T>
+struct type2format< snorm<T> > {
+	static_assert(type2format<T>::type == CL_SIGNED_INT8 || type2format<T>::type == CL_SIGNED_INT16, "snorm needs 8 or 16 bit signed storage");
+	static const cl_channel_type type = type2format<T>::type == CL_SIGNED_INT8 ? CL_SNORM_INT8 : CL_SNORM_INT16;
+	static const cl_channel_order order = type2format<T>::order;
+};
+
+template<>
+struct type2name<half> {
+	static const char* name() { return "half"; }
+};
+
+template<>
+struct type2name<half2> {
+	static const char* name() { return "half2"; }
+};
+
+template<>
+struct type2name<half4> {
+	static const char* name() { return "half4"; }
+};
+
+// kernels see the integer storage
+template<class T>
+struct type2name< unorm<T> > : type2name<T> { };
+
+template<class T>
+struct type2name< snorm<T> > : type2name<T> { };
+
+// Scalar conversions with IEEE round to nearest even, including
+// subnormals, infinities and NaN (returned as a quiet NaN).
+inline half floatToHalf(float f)
+{
+	cl_uint x;
+	std::memcpy(&x, &f, sizeof(x));
+	const cl_uint sign = x & 0x80000000u;
+	x ^= sign;
+	cl_uint bits;
+	if(x >= 0x47800000u)
+	{
+		// 2^16 and above, infinity or NaN
+		bits = x > 0x7f800000u ? 0x7e00u : 0x7c00u;
+	}
+	else if(x < 0x38800000u)
+	{
+		// below 2^-14, the half is subnormal: adding 0.5f aligns the
+		// mantissa so the FPU does the rounding
+		const cl_uint magic = 0x3f000000u;
+		float a, m;
+		std::memcpy(&a, &x, sizeof(a));
+		std::memcpy(&m, &magic, sizeof(m));
+		a += m;
+		std::memcpy(&x, &a, sizeof(x));
+		bits = x - magic;
+	}
+	else
+	{
+		// rebias the exponent and round, a carry out of the mantissa
+		// correctly bumps the exponent up to infinity
+		const cl_uint odd = (x >> 13) & 1;
+		x += 0xc8000fffu + odd;
+		bits = x >> 13;
+	}
+	half h;
+	h.bits = cl_ushort(bits | (sign >> 16));
+	return h;
+}
+
+inline float halfToFloat(half h)
+{
+	const cl_uint exponent = 0x7c00u << 13;
+	cl_uint x = cl_uint(h.bits & 0x7fff) << 13;
+	const cl_uint e = x & exponent;
+	x += (127 - 15) << 23;
+	float f;
+	if(e == exponent)
+	{
+		// infinity or NaN
+		x += (128 - 16) << 23;
+	}
+	else if(e == 0)
+	{
+		// zero or subnormal, renormalized by the FPU
+		const cl_uint magic = 113u << 23;
+		float m;
+		x += 1 << 23;
+		std::memcpy(&f, &x, sizeof(f));
+		std::memcpy(&m, &magic, sizeof(m));
+		f -= m;
+		std::memcpy(&x, &f, sizeof(x));
+	}
+	x |= cl_uint(h.bits & 0x8000) << 16;
+	std::memcpy(&f, &x, sizeof(f));
+	return f;
+}
+
+// Batched conversions of count values, 8 at a time with F16C when the
+// compiler targets it (e.g. -mf16c or -march=native).
+inline void floatToHalf(const float *source, half *target, size_t count)
+{
+	size_t i = 0;
+#ifdef __F16C__
+	for(;i+8<=count;i+=8)
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(target + i), _mm256_cvtps_ph(_mm256_loadu_ps(source + i), _MM_FROUND_TO_NEAREST_INT));
+#endif
+	for(;i<count;++i)
+		target[i] = floatToHalf(source[i]);
+}
+
+inline void halfToFloat(const half *source, float *target, size_t count)
+{
+	size_t i = 0;
+#ifdef __F16C__
+	for(;i+8<=count;i+=8)
+		_mm256_storeu_ps(target + i, _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i))));
+#endif
+	for(;i<count;++i)
+		target[i] = halfToFloat(source[i]);
+}
+
+// Element traits of the storage types: number of channels, the scalar
+// storage of one channel and the matching float type on the host.
+template<class T>
+struct StorageTraits {
+};
+
+#define OPENCL_STORAGE_TRAITS(TEMPLATE,TYPE,SCALAR,CHANNELS,FLOAT)   \
+TEMPLATE                                                            \
+struct StorageTraits< TYPE > {                                      \
+    typedef SCALAR scalar_type;                                     \
+    typedef FLOAT float_type;                                       \
+    static const size_t channels = CHANNELS;                        \
+};                                                                  \
+
+OPENCL_STORAGE_TRAITS(template<>, half, half, 1, cl_float)
+OPENCL_STORAGE_TRAITS(template<>, half2, half, 2, cl_float2)
+OPENCL_STORAGE_TRAITS(template<>, half4, half, 4, cl_float4)
+OPENCL_STORAGE_TRAITS(template<>, unorm<cl_uchar>, cl_uchar, 1, cl_float)
+OPENCL_STORAGE_TRAITS(template<>, unorm<cl_uchar2>, cl_uchar, 2, cl_float2)
+OPENCL_STORAGE_TRAITS(template<>, unorm<cl_uchar4>, cl_uchar, 4, cl_float4)
+OPENCL_STORAGE_TRAITS(template<>, unorm<cl_ushort>, cl_ushort, 1, cl_float)
+OPENCL_STORAGE_TRAITS(template<>, unorm<cl_ushort2>, cl_ushort, 2, cl_float2)
+OPENCL_STORAGE_TRAITS(template<>, unorm<cl_ushort4>, cl_ushort, 4, cl_float4)
+OPENCL_STORAGE_TRAITS(template<>, snorm<cl_char>, cl_char, 1, cl_float)
+OPENCL_STORAGE_TRAITS(template<>, snorm<cl_char2>, cl_char, 2, cl_float2)
+OPENCL_STORAGE_TRAITS(template<>, snorm<cl_char4>, cl_char, 4, cl_float4)
+OPENCL_STORAGE_TRAITS(template<>, snorm<cl_short>, cl_short, 1, cl_float)
+OPENCL_STORAGE_TRAITS(template<>, snorm<cl_short2>, cl_short, 2, cl_float2)
+OPENCL_STORAGE_TRAITS(template<>, snorm<cl_short4>, cl_short, 4, cl_float4)
+
+#undef OPENCL_STORAGE_TRAITS
+
+namespace detail {
+
+// per channel conversions of the normalized types, rounding to nearest
+// like the device does when writing normalized images
+template<class S, bool is_signed = std::is_signed<S>::value>
+struct Normalized {
+	static const int max = std::numeric_limits<S>::max();
+
+	static void fromFloat(const float *source, S *target, size_t count)
+	{
+		for(size_t i = 0;i<count;++i)
+		{
+			// NaN passes the clamp unchanged, the device converts it to 0
+			const float s = source[i] == source[i] ? source[i] : 0.0f;
+			const float v = std::min(std::max(s, is_signed ? -1.0f : 0.0f), 1.0f);
+			target[i] = S(std::lrint(v*max));
+		}
+	}
+
+	static void toFloat(const S *source, float *target, size_t count)
+	{
+		// snorm maps both -max and -max-1 to -1
+		for(size_t i = 0;i<count;++i)
+			target[i] = std::max(source[i]*(1.0f/max), -1.0f);
+	}
+};
+
+template<class T>
+struct Storage {
+	typedef typename StorageTraits<T>::scalar_type scalar_type;
+
+	static void fromFloat(const float *source, T *target, size_t count)
+	{
+		Normalized<scalar_type>::fromFloat(source, reinterpret_cast<scalar_type*>(target), count*StorageTraits<T>::channels);
+	}
+
+	static void toFloat(const T *source, float *target, size_t count)
+	{
+		Normalized<scalar_type>::toFloat(reinterpret_cast<const scalar_type*>(source), target, count*StorageTraits<T>::channels);
+	}
+};
+
+template<class H>
+struct HalfStorage {
+	static void fromFloat(const float *source, H *target, size_t count)
+	{
+		floatToHalf(source, reinterpret_cast<half*>(target), count*StorageTraits<H>::channels);
+	}
+
+	static void toFloat(const H *source, float *target, size_t count)
+	{
+		halfToFloat(reinterpret_cast<const half*>(source), target, count*StorageTraits<H>::channels);
+	}
+};
+
+template<> struct Storage<half> : HalfStorage<half> { };
+template<> struct Storage<half2> : HalfStorage<half2> { };
+template<> struct Storage<half4> : HalfStorage<half4> { };
+
+}
+
+// Converts count elements of a storage type T from and to floats, source
+// and target hold count*StorageTraits<T>::channels floats.
+template<class T>
+void fromFloat(const float *source, T *target, size_t count)
+{
+	detail::Storage<T>::fromFloat(source, target, count);
+}
+
+template<class T>
+void toFloat(const T *source, float *target, size_t count)
+{
+	detail::Storage<T>::toFloat(source, target, count);
+}
+
+// ImageStream converter from float frames to a storage type, e.g.
+// ImageStream< FloatTo<half4> > uploads cl_float4 frames as half images.
+template<class T>
+struct FloatTo {
+	typedef typename StorageTraits<T>::float_type source_type;
+	typedef T target_type;
+
+	static size_t sourcePitch(size_t width) { return width; }
+
+	static void convert(const source_type *source, size_t source_pitch, T *target, size_t target_pitch, size_t width, size_t height)
+	{
+		for(size_t j = 0;j<height;++j)
+			fromFloat(reinterpret_cast<const float*>(source + j*source_pitch), target + j*target_pitch, width);
+	}
+};
+
+}
+
+#endif
@@ -0,0 +1,231 @@
+#ifndef CL_SVM_H
+#define CL_SVM_H
+
+#include <new>
+
+#include "CLEvent.h"
+#include "CLContext.h"
+
+#ifdef CL_VERSION_2_0
+
+namespace clp {
+
+// Shared virtual memory needs an OpenCL 2.0 device. Coarse grained
+// allocations (flags 0) have to be mapped before the host touches them,
+// fine grained ones (CL_MEM_SVM_FINE_GRAIN_BUFFER, optionally with
+// CL_MEM_SVM_ATOMICS) can be used by host and device directly.
+
+// STL allocator handing out SVM. Since containers touch their memory
+// on the host without mapping it, use fine grained flags with it.
+template<class T>
+class SvmAllocator {
+public:
+	typedef T value_type;
+	typedef T* pointer;
+	typedef const T* const_pointer;
+	typedef T& reference;
+	typedef const T& const_reference;
+	typedef size_t size_type;
+	typedef ptrdiff_t difference_type;
+
+	template<class U>
+	struct rebind {
+		typedef SvmAllocator<U> other;
+	};
+
+	SvmAllocator(const Context &c, cl_svm_mem_flags f = CL_MEM_SVM_FINE_GRAIN_BUFFER)
+		: flags(f), context(c)
+	{
+	}
+
+	template<class U>
+	SvmAllocator(const SvmAllocator<U> &a)
+		: flags(a.getFlags()), context(a.getContext())
+	{
+	}
+
+	pointer allocate(size_type n)
+	{
+		void *p = clSVMAlloc(context.getContext(), CL_MEM_READ_WRITE | flags, n*sizeof(value_type), 0);
+		if(!p)
+			throw std::bad_alloc();
+		return static_cast<pointer>(p);
+	}
+
+	void deallocate(pointer p, size_type)
+	{
+		// deferred until the commands already enqueued have finished. Called
+		// from container destructors, so errors must not throw: if the
+		// queue cannot take the free, wait for it and release the memory
+		// directly.
+		void *ptr = p;
+		if(clEnqueueSVMFree(context.getQueue(), 1, &ptr, 0, 0, 0, 0, 0) != CL_SUCCESS)
+		{
+			clFinish(context.getQueue());
+			clSVMFree(context.getContext(), ptr);
+		}
+	}
+
+	cl_svm_mem_flags getFlags() const { return flags; }
+	const Context& getContext() const { return context; }
+
+	template<class U>
+	bool operator==(const SvmAllocator<U> &a) const
+	{
+		return flags == a.getFlags() && context.getContext() == a.getContext().getContext();
+	}
+
+	template<class U>
+	bool operator!=(const SvmAllocator<U> &a) const
+	{
+		return !(*this == a);
+	}
+private:
+	cl_svm_mem_flags flags;
+	Context context;
+};
+
+// Kernel argument wrapper for SVM pointers not owned by an SvmBuffer,
+// for example the data of a container using SvmAllocator.
+template<class T>
+class SvmPtr {
+public:
+	SvmPtr(T *p) : ptr(p) { }
+	T *ptr;
+};
+
+template<class T>
+class SvmBuffer {
+public:
+	typedef T value_type;
+	typedef T& reference;
+	typedef const T& const_reference;
+	typedef T* iterator;
+	typedef const T* const_iterator;
+	typedef const ptrdiff_t difference_type;
+	typedef size_t size_type;
+
+	SvmBuffer(const Context &c, size_t s, cl_svm_mem_flags f = 0)
+		: mapped(false), buffersize(s), flags(f), context(c)
+	{
+		void *p = clSVMAlloc(context.getContext(), CL_MEM_READ_WRITE | flags, buffersize*sizeof(value_type), 0);
+		if(!p)
+			throw std::runtime_error("SVM allocation failed");
+		ptr = static_cast<value_type*>(p);
+	}
+
+	// for fine grained buffers map and unmap only order the host access
+	// against previously enqueued commands
+	Event map(cl_map_flags map_flags = CL_MAP_READ | CL_MAP_WRITE)
+	{
+		return map(map_flags, 0, 0);
+	}
+
+	Event map(cl_map_flags map_flags, const Event &event)
+	{
+		return map(map_flags, 1, event.getEventPtr());
+	}
+
+	Event map(cl_map_flags map_flags, cl_uint event_count, const cl_event *events)
+	{
+		check_unmapped();
+		cl_event e;
+		cl_int error;
+		if(isFineGrained())
+			error = clEnqueueMarkerWithWaitList(context.getQueue(), event_count, events, &e);
+		else
+			error = clEnqueueSVMMap(context.getQueue(), CL_FALSE, map_flags, ptr, buffersize*sizeof(value_type), event_count, events, &e);
+		checkError(error);
+		mapped = true;
+		event = Event(e);
+		return event;
+	}
+
+	Event unmap()
+	{
+		return unmap(0, 0);
+	}
+
+	Event unmap(const Event &event)
+	{
+		return unmap(1, event.getEventPtr());
+	}
+
+	Event unmap(cl_uint event_count, const cl_event *events)
+	{
+		check_mapped();
+		cl_event e;
+		cl_int error;
+		if(isFineGrained())
+			error = clEnqueueMarkerWithWaitList(context.getQueue(), event_count, events, &e);
+		else
+			error = clEnqueueSVMUnmap(context.getQueue(), ptr, event_count, events, &e);
+		mapped = false;
+		checkError(error);
+		event = Event(e);
+		return event;
+	}
+
+	inline reference operator[](size_t i)
+	{
+		check_mapped();
+		return ptr[i];
+	}
+
+	inline const_reference operator[](size_t i) const
+	{
+		check_mapped();
+		return ptr[i];
+	}
+
+	inline value_type* data() { check_mapped(); return ptr; }
+	inline const value_type* data() const { check_mapped(); return ptr; }
+	inline iterator begin() { check_mapped(); return ptr; }
+	inline const_iterator begin() const { check_mapped(); return ptr; }
+	inline iterator end() { check_mapped(); return ptr+buffersize; }
+	inline const_iterator end() const { check_mapped(); return ptr+buffersize; }
+
+	inline size_type size() const { return buffersize; }
+
+	// raw SVM pointer, valid on the device and for building pointer
+	// based structures inside the allocation
+	value_type* get() const { return ptr; }
+	Event getLastEvent() { return event; }
+
+	bool isMapped() const { return mapped; }
+	bool isFineGrained() const { return (flags & CL_MEM_SVM_FINE_GRAIN_BUFFER) != 0; }
+
+	~SvmBuffer()
+	{
+		void *p = ptr;
+		clEnqueueSVMFree(context.getQueue(), 1, &p, 0, 0, 0, 0, 0);
+	}
+private:
+	SvmBuffer(const SvmBuffer&) { }
+	SvmBuffer& operator=(const SvmBuffer&) { return *this; }
+
+	inline void check_mapped() const
+	{
+		if(!mapped && !isFineGrained())
+			throw std::runtime_error("Buffer not mapped");
+	}
+
+	inline void check_unmapped() const
+	{
+		if(mapped)
+			throw std::runtime_error("Buffer mapped");
+	}
+
+	value_type *ptr;
+	bool mapped;
+	size_t buffersize;
+	cl_svm_mem_flags flags;
+	Event event;
+	Context context;
+};
+
+}
+
+#endif
+
+#endif
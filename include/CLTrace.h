@@ -0,0 +1,337 @@
+#ifndef CL_TRACE_H
+#define CL_TRACE_H
+
+// Opt-in tracing of host API calls and the device commands they enqueue.
+// Define CLP_TRACE before including any clp header to enable it, otherwise
+// the instrumentation macros expand to nothing. Queues are then created
+// with profiling enabled so device spans can be read back from events.
+//
+// Every thread records into its own ring buffer without locking; when a
+// ring is full the oldest records are overwritten. writeChromeTrace()
+// produces a JSON file for chrome://tracing or ui.perfetto.dev with one
+// lane per host thread and per command queue, flow arrows from each call
+// to its device command and from wait list entries to their dependents.
+// Export while the traced threads are idle to get consistent results.
+
+#ifdef CLP_TRACE
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define CL_USE_DEPRECATED_OPENCL_1_1_APIS
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#ifndef CLP_TRACE_CAPACITY
+#define CLP_TRACE_CAPACITY 16384
+#endif
+
+#define CLP_TRACE_SCOPE(name) ::clp::trace::Scope clp_trace_scope(name)
+#define CLP_TRACE_DEVICE(queue, event, event_count, events, bytes) clp_trace_scope.device(queue, event, event_count, events, bytes)
+#define CLP_TRACE_KERNEL(k) clp_trace_scope.kernel(k)
+
+namespace clp
+{
+namespace trace
+{
+
+// dependencies beyond this many wait list entries are not drawn
+const cl_uint max_waits = 4;
+
+struct Record {
+	char name[48];
+	cl_ulong begin, end;
+	size_t bytes;
+	cl_command_queue queue;
+	cl_event event;
+	cl_uint wait_count;
+	cl_event waits[max_waits];
+};
+
+inline cl_ulong now()
+{
+	return cl_ulong(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// Single producer ring, only the owning thread writes. Device events and
+// their wait lists stay retained until their record is overwritten or
+// cleared, so the handles cannot be reused for other commands meanwhile.
+class Ring {
+public:
+	Ring(size_t lane)
+		: records(CLP_TRACE_CAPACITY), head(0), lane(lane)
+	{
+	}
+
+	void push(const Record &r)
+	{
+		const size_t h = head.load(std::memory_order_relaxed);
+		Record &slot = records[h % records.size()];
+		if(h >= records.size())
+			release(slot);
+		slot = r;
+		head.store(h + 1, std::memory_order_release);
+	}
+
+	// copies the records currently held, oldest first
+	void snapshot(std::vector<Record> &out) const
+	{
+		const size_t h = head.load(std::memory_order_acquire);
+		const size_t count = std::min(h, records.size());
+		for(size_t i = h - count;i<h;++i)
+			out.push_back(records[i % records.size()]);
+	}
+
+	void clear()
+	{
+		const size_t h = head.load(std::memory_order_acquire);
+		for(size_t i = h - std::min(h, records.size());i<h;++i)
+			release(records[i % records.size()]);
+		head.store(0, std::memory_order_release);
+	}
+
+	size_t getLane() const { return lane; }
+
+	~Ring()
+	{
+		clear();
+	}
+private:
+	static void release(Record &r)
+	{
+		if(r.event)
+			clReleaseEvent(r.event);
+		r.event = 0;
+		for(cl_uint i = 0;i<r.wait_count;++i)
+			clReleaseEvent(r.waits[i]);
+		r.wait_count = 0;
+	}
+
+	std::vector<Record> records;
+	std::atomic<size_t> head;
+	size_t lane;
+};
+
+class Tracer {
+public:
+	static Tracer& instance()
+	{
+		static Tracer tracer;
+		return tracer;
+	}
+
+	// ring of the calling thread, registered on first use
+	Ring& ring()
+	{
+		static thread_local std::shared_ptr<Ring> local;
+		if(!local)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			local = std::make_shared<Ring>(rings.size());
+			rings.push_back(local);
+		}
+		return *local;
+	}
+
+	void clear()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for(size_t i = 0;i<rings.size();++i)
+			rings[i]->clear();
+	}
+
+	std::string chromeTrace()
+	{
+		std::vector<std::pair<size_t, Record> > all;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			for(size_t i = 0;i<rings.size();++i)
+			{
+				std::vector<Record> records;
+				rings[i]->snapshot(records);
+				for(size_t j = 0;j<records.size();++j)
+					all.push_back(std::make_pair(rings[i]->getLane(), records[j]));
+			}
+		}
+
+		// device timestamps, and per queue offsets onto the host clock
+		std::vector<cl_ulong> queued(all.size()), start(all.size()), end(all.size());
+		std::vector<bool> device(all.size(), false);
+		std::map<cl_command_queue, cl_long> offsets;
+		std::map<cl_command_queue, size_t> lanes;
+		std::map<cl_event, size_t> by_event;
+		for(size_t i = 0;i<all.size();++i)
+		{
+			const Record &r = all[i].second;
+			if(!r.event)
+				continue;
+			if(clGetEventProfilingInfo(r.event, CL_PROFILING_COMMAND_QUEUED, sizeof(cl_ulong), &queued[i], 0) != CL_SUCCESS ||
+				clGetEventProfilingInfo(r.event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start[i], 0) != CL_SUCCESS ||
+				clGetEventProfilingInfo(r.event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end[i], 0) != CL_SUCCESS)
+				continue;
+			device[i] = true;
+			by_event[r.event] = i;
+			if(!lanes.count(r.queue))
+				lanes.insert(std::make_pair(r.queue, lanes.size()));
+			// the command was queued during the host call, so the offset is
+			// at least begin - queued for every command of the queue
+			const cl_long offset = cl_long(r.begin) - cl_long(queued[i]);
+			std::map<cl_command_queue, cl_long>::iterator o = offsets.find(r.queue);
+			if(o == offsets.end())
+				offsets[r.queue] = offset;
+			else
+				o->second = std::max(o->second, offset);
+		}
+
+		cl_ulong base = ~cl_ulong(0);
+		for(size_t i = 0;i<all.size();++i)
+			base = std::min(base, all[i].second.begin);
+
+		cl_ulong flows = 0;
+		std::ostringstream out;
+		out.setf(std::ios::fixed);
+		out.precision(3);
+		out << "{\"traceEvents\": [\n";
+		out << "{\"ph\": \"M\", \"pid\": 1, \"name\": \"process_name\", \"args\": {\"name\": \"host\"}},\n";
+		out << "{\"ph\": \"M\", \"pid\": 2, \"name\": \"process_name\", \"args\": {\"name\": \"device\"}}";
+		for(std::map<cl_command_queue, size_t>::iterator q = lanes.begin();q!=lanes.end();++q)
+			out << ",\n{\"ph\": \"M\", \"pid\": 2, \"tid\": " << q->second << ", \"name\": \"thread_name\", \"args\": {\"name\": \"queue " << q->second << "\"}}";
+		for(size_t i = 0;i<all.size();++i)
+		{
+			const size_t lane = all[i].first;
+			const Record &r = all[i].second;
+			const double host_begin = (r.begin - base)*1e-3;
+			out << ",\n{\"ph\": \"X\", \"pid\": 1, \"tid\": " << lane << ", \"name\": \"" << r.name
+				<< "\", \"ts\": " << host_begin << ", \"dur\": " << (r.end - r.begin)*1e-3 << "}";
+			if(!device[i])
+				continue;
+
+			const cl_long offset = offsets[r.queue];
+			const double device_begin = (cl_long(start[i]) + offset - cl_long(base))*1e-3;
+			const size_t queue_lane = lanes[r.queue];
+			out << ",\n{\"ph\": \"X\", \"pid\": 2, \"tid\": " << queue_lane << ", \"name\": \"" << r.name
+				<< "\", \"ts\": " << device_begin << ", \"dur\": " << (end[i] - start[i])*1e-3
+				<< ", \"args\": {\"queued_us\": " << (start[i] - queued[i])*1e-3;
+			if(r.bytes)
+				out << ", \"bytes\": " << r.bytes;
+			out << "}}";
+			flow(out, ++flows, 1, lane, host_begin, 2, queue_lane, device_begin);
+			for(cl_uint w = 0;w<std::min(r.wait_count, max_waits);++w)
+			{
+				std::map<cl_event, size_t>::iterator d = by_event.find(r.waits[w]);
+				if(d == by_event.end())
+					continue;
+				const Record &dependency = all[d->second].second;
+				const double dependency_begin = (cl_long(start[d->second]) + offsets[dependency.queue] - cl_long(base))*1e-3;
+				flow(out, ++flows, 2, lanes[dependency.queue], dependency_begin, 2, queue_lane, device_begin);
+			}
+		}
+		out << "\n],\n\"displayTimeUnit\": \"ns\"}\n";
+		return out.str();
+	}
+
+	void writeChromeTrace(const std::string &path)
+	{
+		std::ofstream file(path.c_str());
+		if(!file)
+			throw std::runtime_error("cannot write " + path);
+		file << chromeTrace();
+	}
+private:
+	Tracer() { }
+	Tracer(const Tracer&);
+	Tracer& operator=(const Tracer&);
+
+	static void flow(std::ostream &out, cl_ulong id, int from_pid, size_t from_tid, double from_ts, int to_pid, size_t to_tid, double to_ts)
+	{
+		out << ",\n{\"ph\": \"s\", \"id\": " << id << ", \"name\": \"flow\", \"cat\": \"flow\", \"pid\": " << from_pid << ", \"tid\": " << from_tid << ", \"ts\": " << from_ts << "}";
+		out << ",\n{\"ph\": \"f\", \"bp\": \"e\", \"id\": " << id << ", \"name\": \"flow\", \"cat\": \"flow\", \"pid\": " << to_pid << ", \"tid\": " << to_tid << ", \"ts\": " << to_ts << "}";
+	}
+
+	std::mutex mutex;
+	std::vector<std::shared_ptr<Ring> > rings;
+};
+
+// Records the lifetime of the enclosing block as a host span, optionally
+// together with the device command it enqueued.
+class Scope {
+public:
+	Scope(const char *name)
+	{
+		std::memset(&record, 0, sizeof(record));
+		std::strncpy(record.name, name, sizeof(record.name) - 1);
+		record.begin = now();
+	}
+
+	void device(cl_command_queue queue, cl_event event, cl_uint event_count, const cl_event *events, size_t bytes)
+	{
+		if(clRetainEvent(event) != CL_SUCCESS)
+			return;
+		record.queue = queue;
+		record.event = event;
+		record.bytes = bytes;
+		const cl_uint waits = events ? std::min(event_count, max_waits) : 0;
+		for(cl_uint i = 0;i<waits;++i)
+			if(clRetainEvent(events[i]) == CL_SUCCESS)
+				record.waits[record.wait_count++] = events[i];
+	}
+
+	// names the span after the kernel function
+	void kernel(cl_kernel k)
+	{
+		char name[sizeof(record.name)] = {0};
+		if(clGetKernelInfo(k, CL_KERNEL_FUNCTION_NAME, sizeof(name) - 1, name, 0) == CL_SUCCESS)
+			std::strncpy(record.name, name, sizeof(record.name) - 1);
+	}
+
+	~Scope()
+	{
+		record.end = now();
+		Tracer::instance().ring().push(record);
+	}
+private:
+	Scope(const Scope&);
+	Scope& operator=(const Scope&);
+
+	Record record;
+};
+
+inline void clear()
+{
+	Tracer::instance().clear();
+}
+
+inline std::string chromeTrace()
+{
+	return Tracer::instance().chromeTrace();
+}
+
+inline void writeChromeTrace(const std::string &path)
+{
+	Tracer::instance().writeChromeTrace(path);
+}
+
+}
+}
+
+#else
+
+#define CLP_TRACE_SCOPE(name) ((void)0)
+#define CLP_TRACE_DEVICE(queue, event, event_count, events, bytes) ((void)0)
+#define CLP_TRACE_KERNEL(kernel) ((void)0)
+
+#endif
+
+#endif
@@ -69,6 +69,15 @@ inline std::string getStringFromError(cl_int error)
 		OPENCL_ERROR_CASE(CL_INVALID_MIP_LEVEL)
 		OPENCL_ERROR_CASE(CL_INVALID_GLOBAL_WORK_SIZE)
 		OPENCL_ERROR_CASE(CL_INVALID_PROPERTY)
+#ifdef CL_VERSION_1_2
+		OPENCL_ERROR_CASE(CL_COMPILE_PROGRAM_FAILURE)
+		OPENCL_ERROR_CASE(CL_LINKER_NOT_AVAILABLE)
+		OPENCL_ERROR_CASE(CL_LINK_PROGRAM_FAILURE)
+		OPENCL_ERROR_CASE(CL_KERNEL_ARG_INFO_NOT_AVAILABLE)
+		OPENCL_ERROR_CASE(CL_INVALID_IMAGE_DESCRIPTOR)
+		OPENCL_ERROR_CASE(CL_INVALID_COMPILER_OPTIONS)
+		OPENCL_ERROR_CASE(CL_INVALID_LINKER_OPTIONS)
+#endif
 		default: return "unknown error code";
 	}
 }
@@ -113,6 +122,40 @@ OPENCL_TYPE2DEFINE(cl_float, CL_FLOAT)
 
 #undef OPENCL_TYPE2DEFINE
 
+// OpenCL C spelling of host types, name() is 0 for types without one
+template<class T>
+struct type2name {
+	static const char* name() { return 0; }
+};
+
+#define OPENCL_TYPE2NAME(T,NAME)                                    \
+template<>                                                          \
+struct type2name<T> {                                               \
+    static const char* name() { return NAME; }                      \
+};                                                                  \
+template<>                                                          \
+struct type2name<T##2> {                                            \
+    static const char* name() { return NAME "2"; }                  \
+};                                                                  \
+template<>                                                          \
+struct type2name<T##4> {                                            \
+    static const char* name() { return NAME "4"; }                  \
+};                                                                  \
+
+
+OPENCL_TYPE2NAME(cl_char, "char")
+OPENCL_TYPE2NAME(cl_short, "short")
+OPENCL_TYPE2NAME(cl_int, "int")
+OPENCL_TYPE2NAME(cl_long, "long")
+OPENCL_TYPE2NAME(cl_uchar, "uchar")
+OPENCL_TYPE2NAME(cl_ushort, "ushort")
+OPENCL_TYPE2NAME(cl_uint, "uint")
+OPENCL_TYPE2NAME(cl_ulong, "ulong")
+OPENCL_TYPE2NAME(cl_float, "float")
+OPENCL_TYPE2NAME(cl_double, "double")
+
+#undef OPENCL_TYPE2NAME
+
 }
 
 #endif
@@ -0,0 +1,198 @@
+#ifndef CL_WORKQUEUE_H
+#define CL_WORKQUEUE_H
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "CLEvent.h"
+#include "CLContext.h"
+#include "CLSvm.h"
+#include "CLProgram.h"
+
+#ifdef CL_VERSION_2_0
+
+namespace clp {
+
+// Low latency dispatch of small requests to a persistent kernel. The
+// kernel is launched once and its workers poll a ring of work items in
+// fine grained SVM, so submitting a request is a store and an atomic
+// release instead of a clEnqueueNDRangeKernel round trip. Needs a device
+// with CL_DEVICE_SVM_ATOMICS.
+//
+// source defines the item type and a handler
+//
+//	void function(global type *item)
+//
+// called once per submitted item. The item lives in SVM, so the handler
+// can write its results into it or follow SVM pointers stored in it.
+// T is the host side layout of the same type.
+//
+// Every ticket t uses slot t % capacity. A slot's sequence word holds
+// 2t+1 once the host published ticket t and 2t+2 once a worker finished
+// it, workers claim tickets with an atomic counter. shutdown() publishes
+// the number of submitted tickets and sets a stop flag; workers finish
+// every ticket below that number and return, so no request is dropped.
+//
+// The kernel occupies the current queue of the context until shutdown,
+// use a context with a second queue for other work. A WorkQueue must only
+// be used by one thread at a time.
+template<class T>
+class WorkQueue {
+public:
+	// workers = 0 starts one worker per compute unit. capacity is rounded
+	// up to a power of two.
+	WorkQueue(const Context &c, const std::string &source, const std::string &type, const std::string &function, size_t capacity = 64, size_t workers = 0)
+		: slots(roundUp(capacity)), submitted(0), running(false), context(c), program(c),
+		control(c, 4, svm_flags), sequence(c, slots, svm_flags), items(c, slots, svm_flags)
+	{
+		static_assert(sizeof(std::atomic<cl_uint>) == sizeof(cl_uint), "std::atomic<cl_uint> cannot alias SVM words");
+		if(!(context.getDeviceInfo().svm_capabilities & CL_DEVICE_SVM_ATOMICS))
+			throw std::runtime_error("device does not support fine grained SVM atomics");
+		if(workers == 0)
+			workers = context.getDeviceInfo().compute_units;
+
+		word(control, claimed).store(0, std::memory_order_relaxed);
+		word(control, published).store(0, std::memory_order_relaxed);
+		word(control, stop).store(0, std::memory_order_relaxed);
+		// slot i starts out as finished for ticket i - slots
+		for(cl_uint i = 0;i<slots;++i)
+			word(sequence, i).store(finished(i - slots), std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		program.setSource(kernelSource(source, type, function));
+		program.build("-cl-std=CL2.0");
+		Kernel<Signature> kernel = program.getKernel<Signature>("clp_persistent");
+		const cl_uint mask = slots - 1;
+		event = kernel(Worksize(workers, 1), control, sequence, items, mask);
+		// the workers have to start without further commands on the queue
+		checkError(clFlush(context.getQueue()));
+		running = true;
+	}
+
+	// Copies item into the next slot and publishes it. Spins while the
+	// slot still holds the ticket submitted capacity tickets earlier.
+	// Returns the ticket to wait on.
+	cl_uint submit(const T &item)
+	{
+		if(!running)
+			throw std::runtime_error("WorkQueue shut down");
+		const cl_uint ticket = submitted;
+		std::atomic<cl_uint> &state = word(sequence, ticket & (slots - 1));
+		spin([&]() { return state.load(std::memory_order_acquire) == finished(ticket - slots); });
+		items.get()[ticket & (slots - 1)] = item;
+		state.store(ticket*2 + 1, std::memory_order_release);
+		++submitted;
+		return ticket;
+	}
+
+	bool isDone(cl_uint ticket)
+	{
+		return word(sequence, ticket & (slots - 1)).load(std::memory_order_acquire) == finished(ticket);
+	}
+
+	// Waits until ticket was processed and returns its item as the handler
+	// left it. Call it before submitting capacity further tickets, which
+	// reuse the slot.
+	T wait(cl_uint ticket)
+	{
+		spin([&]() { return isDone(ticket); });
+		return items.get()[ticket & (slots - 1)];
+	}
+
+	// Lets the workers drain all submitted tickets and waits for the
+	// kernel to return.
+	void shutdown()
+	{
+		if(!running)
+			return;
+		running = false;
+		word(control, published).store(submitted, std::memory_order_relaxed);
+		word(control, stop).store(1, std::memory_order_release);
+		event.wait();
+	}
+
+	size_t getCapacity() const { return slots; }
+	cl_uint getSubmitted() const { return submitted; }
+	bool isRunning() const { return running; }
+
+	~WorkQueue()
+	{
+		shutdown();
+	}
+private:
+	WorkQueue(const WorkQueue&);
+	WorkQueue& operator=(const WorkQueue&);
+
+	typedef void Signature(SvmBuffer<cl_uint>, SvmBuffer<cl_uint>, SvmBuffer<T>, cl_uint);
+
+	static const cl_svm_mem_flags svm_flags = CL_MEM_SVM_FINE_GRAIN_BUFFER | CL_MEM_SVM_ATOMICS;
+
+	// words of the control block
+	enum { claimed = 0, published = 1, stop = 2 };
+
+	static cl_uint finished(cl_uint ticket) { return ticket*2 + 2; }
+
+	static std::atomic<cl_uint>& word(SvmBuffer<cl_uint> &buffer, cl_uint i)
+	{
+		return reinterpret_cast<std::atomic<cl_uint>*>(buffer.get())[i];
+	}
+
+	static cl_uint roundUp(size_t n)
+	{
+		cl_uint p = 1;
+		while(p < n)
+			p *= 2;
+		return p;
+	}
+
+	// busy waits for the lowest latency, yielding now and then so the host
+	// thread does not starve workers sharing its core on CPU devices
+	template<class F>
+	static void spin(F ready)
+	{
+		for(size_t i = 1;!ready();++i)
+			if(i % 1024 == 0)
+				std::this_thread::yield();
+	}
+
+	static std::string kernelSource(const std::string &source, const std::string &type, const std::string &function)
+	{
+		return source + "\n"
+			"kernel void clp_persistent(global atomic_uint *control, global atomic_uint *sequence, global " + type + " *items, uint mask)\n"
+			"{\n"
+			"	for(;;)\n"
+			"	{\n"
+			"		const uint ticket = atomic_fetch_add_explicit(&control[0], 1u, memory_order_relaxed, memory_scope_device);\n"
+			"		global atomic_uint *state = &sequence[ticket & mask];\n"
+			"		for(;;)\n"
+			"		{\n"
+			"			if(atomic_load_explicit(state, memory_order_acquire, memory_scope_all_svm_devices) == ticket*2 + 1)\n"
+			"				break;\n"
+			"			if(atomic_load_explicit(&control[2], memory_order_acquire, memory_scope_all_svm_devices) &&\n"
+			"				(int)(ticket - atomic_load_explicit(&control[1], memory_order_relaxed, memory_scope_all_svm_devices)) >= 0)\n"
+			"				return;\n"
+			"		}\n"
+			"		" + function + "(&items[ticket & mask]);\n"
+			"		atomic_store_explicit(state, ticket*2 + 2, memory_order_release, memory_scope_all_svm_devices);\n"
+			"	}\n"
+			"}\n";
+	}
+
+	cl_uint slots;
+	cl_uint submitted;
+	bool running;
+	Context context;
+	Program program;
+	SvmBuffer<cl_uint> control;
+	SvmBuffer<cl_uint> sequence;
+	SvmBuffer<T> items;
+	Event event;
+};
+
+}
+
+#endif
+
+#endif
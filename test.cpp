@@ -1,14 +1,225 @@
 #include <iostream>
 #include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
 
 #include "include/CLUtility.h"
 #include "include/CLEvent.h"
 #include "include/CLContext.h"
 #include "include/CLBuffer.h"
 #include "include/CLProgram.h"
+#include "include/CLStorage.h"
+#include "include/CLCompress.h"
+
+namespace {
+
+int failures = 0;
+
+void check(bool condition, const char *what)
+{
+	if(!condition)
+	{
+		std::cerr << "failed: " << what << std::endl;
+		++failures;
+	}
+}
+
+cl_ushort halfBits(float f)
+{
+	return clp::floatToHalf(f).bits;
+}
+
+bool isNan(float f)
+{
+	return f != f;
+}
+
+// Host conversions of the compact storage types: special values and ties
+// of the scalar half conversion, the batched path against the scalar one,
+// and the endpoints of the normalized types.
+void testStorage()
+{
+	const float inf = std::numeric_limits<float>::infinity();
+	const float nan = std::numeric_limits<float>::quiet_NaN();
+	check(halfBits(std::ldexp(1.0f, -24)) == 0x0001, "smallest subnormal half");
+	check(halfBits(std::ldexp(1023.0f, -24)) == 0x03ff, "largest subnormal half");
+	check(halfBits(std::ldexp(1.0f, -25)) == 0x0000, "subnormal tie rounds to even");
+	check(halfBits(std::ldexp(3.0f, -25)) == 0x0002, "subnormal tie rounds to even");
+	check(halfBits(1.0f + std::ldexp(1.0f, -11)) == 0x3c00, "tie rounds to even");
+	check(halfBits(1.0f + std::ldexp(3.0f, -11)) == 0x3c02, "tie rounds to even");
+	check(halfBits(65504.0f) == 0x7bff && halfBits(65519.0f) == 0x7bff, "largest half");
+	check(halfBits(65520.0f) == 0x7c00, "overflow rounds to infinity");
+	check(halfBits(inf) == 0x7c00 && halfBits(-inf) == 0xfc00, "infinities");
+	check(halfBits(-0.0f) == 0x8000, "negative zero");
+	check((halfBits(nan) & 0x7c00) == 0x7c00 && (halfBits(nan) & 0x03ff) != 0, "NaN stays NaN");
+
+	// every half survives the round trip through float
+	bool exact = true;
+	for(cl_uint bits = 0;bits<0x10000;++bits)
+	{
+		clp::half h;
+		h.bits = cl_ushort(bits);
+		const float f = clp::halfToFloat(h);
+		exact = exact && (isNan(f) ? (bits & 0x7c00) == 0x7c00 && (bits & 0x03ff) : halfBits(f) == bits);
+	}
+	check(exact, "half round trip");
+
+	// batched conversions, vectorized with F16C, against the scalar path
+	std::vector<float> values;
+	const float specials[] = {0.0f, -0.0f, 1.0f, -2.5f, 65504.0f, 65520.0f, inf, -inf, nan, std::ldexp(1.0f, -24), std::ldexp(3.0f, -25), 1.0f + std::ldexp(1.0f, -11)};
+	for(int r = 0;r<3;++r)
+		for(size_t i = 0;i<sizeof(specials)/sizeof(specials[0]);++i)
+			values.push_back(specials[i]*(r + 1));
+	std::vector<clp::half> halves(values.size());
+	std::vector<float> back(values.size());
+	clp::floatToHalf(values.data(), halves.data(), values.size());
+	clp::halfToFloat(halves.data(), back.data(), values.size());
+	bool batched = true;
+	for(size_t i = 0;i<values.size();++i)
+	{
+		const float f = clp::halfToFloat(halves[i]);
+		if(isNan(values[i]))
+			batched = batched && isNan(f) && isNan(back[i]);
+		else
+			batched = batched && halves[i].bits == halfBits(values[i]) && back[i] == f;
+	}
+	check(batched, "batched half conversions");
+
+	const float inputs[] = {0.0f, 1.0f, -1.0f, 0.5f, 2.0f, -2.0f, nan};
+	const size_t count = sizeof(inputs)/sizeof(inputs[0]);
+	clp::unorm<cl_uchar> u8[count];
+	clp::fromFloat(inputs, u8, count);
+	check(u8[0].value == 0 && u8[1].value == 255 && u8[2].value == 0 && u8[3].value == 128 && u8[4].value == 255 && u8[5].value == 0 && u8[6].value == 0, "unorm8 from float");
+	clp::unorm<cl_ushort> u16[count];
+	clp::fromFloat(inputs, u16, count);
+	check(u16[1].value == 65535 && u16[3].value == 32768 && u16[6].value == 0, "unorm16 from float");
+	clp::snorm<cl_char> s8[count];
+	clp::fromFloat(inputs, s8, count);
+	check(s8[0].value == 0 && s8[1].value == 127 && s8[2].value == -127 && s8[4].value == 127 && s8[5].value == -127 && s8[6].value == 0, "snorm8 from float");
+	clp::snorm<cl_short> s16[count];
+	clp::fromFloat(inputs, s16, count);
+	check(s16[1].value == 32767 && s16[2].value == -32767 && s16[6].value == 0, "snorm16 from float");
+
+	const clp::snorm<cl_char> ends[] = {{-128}, {-127}, {0}, {127}};
+	float f[4];
+	clp::toFloat(ends, f, 4);
+	check(f[0] == -1.0f && f[1] == -1.0f && f[2] == 0.0f && f[3] == 1.0f, "snorm8 to float");
+	bool unorm_exact = true;
+	for(int v = 0;v<256;++v)
+	{
+		const clp::unorm<cl_uchar> in = {cl_uchar(v)};
+		clp::unorm<cl_uchar> out;
+		float g;
+		clp::toFloat(&in, &g, 1);
+		clp::fromFloat(&g, &out, 1);
+		unorm_exact = unorm_exact && out.value == v && g >= 0.0f && g <= 1.0f;
+	}
+	check(unorm_exact, "unorm8 round trip");
+}
+
+// Packs values on the host, unpacks them again and returns the bit width
+// of every block, or an empty vector if the round trip changed a value.
+template<class T>
+std::vector<cl_uint> roundTrip(const std::vector<T> &values, bool delta)
+{
+	std::vector<cl_uint> headers, payload;
+	clp::Compressor<T>::encode(values.data(), values.size(), delta, headers, payload);
+	std::vector<T> decoded(values.size());
+	clp::Compressor<T>::decode(headers, payload, values.size(), delta, decoded.data());
+	std::vector<cl_uint> widths;
+	if(decoded == values)
+		for(size_t i = 2;i<headers.size();i += clp::detail::Packing::header)
+			widths.push_back(headers[i]);
+	return widths;
+}
+
+// Host packing of the compressed transfers: constant and full range
+// blocks, a partial last block, signed data and delta blocks with
+// negative steps.
+void testCompression()
+{
+	const size_t block = clp::detail::Packing::block;
+	std::vector<cl_uint> constant(2*block, 7);
+	check(roundTrip(constant, false) == std::vector<cl_uint>(2, 0), "zero width blocks");
+	check(roundTrip(constant, true) == std::vector<cl_uint>(2, 0), "zero width delta blocks");
+
+	std::vector<cl_uint> full(block);
+	for(size_t i = 0;i<block;++i)
+		full[i] = i % 2 ? 0xffffffffu : cl_uint(i*2654435761u);
+	full[0] = 0;
+	check(roundTrip(full, false) == std::vector<cl_uint>(1, 32), "full width block");
+	check(roundTrip(full, true) == std::vector<cl_uint>(1, 32), "full width delta block");
+
+	std::vector<cl_ushort> partial(2*block + 37);
+	for(size_t i = 0;i<partial.size();++i)
+		partial[i] = cl_ushort(1000 + i % 16);
+	const std::vector<cl_uint> partial_widths = roundTrip(partial, false);
+	check(partial_widths.size() == 3 && partial_widths[2] == 4, "partial last block");
+
+	std::vector<cl_int> sign(block + 5);
+	for(size_t i = 0;i<sign.size();++i)
+		sign[i] = cl_int(i % 64) - 32;
+	const std::vector<cl_uint> sign_widths = roundTrip(sign, false);
+	check(sign_widths.size() == 2 && sign_widths[0] == 6 && sign_widths[1] == 3, "signed blocks");
+	std::vector<cl_char> bytes(block);
+	for(size_t i = 0;i<block;++i)
+		bytes[i] = cl_char(i % 2 ? -128 : 127);
+	check(roundTrip(bytes, false) == std::vector<cl_uint>(1, 8), "signed extremes");
+
+	std::vector<cl_int> falling(block + 100);
+	for(size_t i = 0;i<falling.size();++i)
+		falling[i] = 1000000 - cl_int(i)*3 - cl_int(i % 2);
+	const std::vector<cl_uint> falling_widths = roundTrip(falling, true);
+	check(falling_widths == std::vector<cl_uint>(2, 3), "delta blocks with negative steps");
+	std::vector<cl_uint> wrapping(block);
+	for(size_t i = 0;i<block;++i)
+		wrapping[i] = cl_uint(5 - cl_int(i));
+	check(roundTrip(wrapping, true) == std::vector<cl_uint>(1, 1), "delta block wrapping below zero");
+}
+
+// Two buffers that do not fit into the memory budget together: using one
+// evicts the other and both keep their contents, a mapped buffer stays
+// resident, and a launch gets both of them.
+void testResidency(clp::Context &context, clp::Kernel<void(float*, float*, float)> &saxpy)
+{
+	const size_t n = 1 << 16;
+	const cl_ulong bytes = n*sizeof(float);
+	context.setMemoryBudget(bytes + bytes/2);
+	const clp::Residency &residency = *context.getResidency();
+	std::vector<float> ones(n, 1), twos(n, 2), result(n);
+	{
+		clp::Buffer<float> a(context, n), b(context, n);
+		a.write(ones.data()).wait();
+		b.write(twos.data()).wait();
+		a.read(result.data()).wait();
+		check(result == ones, "evicted buffer restored");
+		b.read(result.data()).wait();
+		check(result == twos, "evicted buffer restored");
+		clp::ResidencyStats stats = residency.getStats();
+		check(stats.evictions >= 3 && stats.restores >= 2, "buffers evicted and restored");
+		check(stats.resident_bytes <= stats.budget, "budget kept");
+
+		a.map().wait();
+		b.read(result.data()).wait();
+		check(residency.getStats().resident_bytes == 2*bytes, "mapped buffer not evicted");
+		check(a[0] == 1 && a[n - 1] == 1, "mapped buffer contents");
+		a.unmap().wait();
+
+		saxpy(clp::Worksize(n, 256), a, b, 3).wait();
+		a.read(result.data()).wait();
+		check(result == std::vector<float>(n, 7), "launch with evicted arguments");
+	}
+	check(residency.getStats().resident_bytes == 0, "released buffers leave the budget");
+}
+
+}
 
 int main()
 {
+	testStorage();
+	testCompression();
+
 	// create a context for the second GPU with one command queues
 	clp::Context context(CL_DEVICE_TYPE_GPU, 1, 1);
 
@@ -45,6 +256,8 @@ int main()
 
 	// execute kernel
 	saxpy(clp::Worksize(1024,256), x, y, 13);
+
+	testResidency(context, saxpy);
 	
-	return 0;
+	return failures ? 1 : 0;
 }
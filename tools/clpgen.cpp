@@ -0,0 +1,264 @@
+// clpgen: generates typed kernel wrappers from OpenCL C sources.
+//
+//   clpgen input.cl output.h [namespace]
+//
+// The generated header embeds the source and declares a Module class with
+// one accessor per kernel returning a clp::Kernel of the matching signature,
+// so no signature has to be written or checked by hand. Run it as a build
+// step and compile the output with include/ on the include path.
+
+#include <cctype>
+#include <fstream>
+#include <iostream>
+#include <regex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+const size_t max_arguments = 8;
+
+struct KernelDecl {
+	std::string name;
+	std::vector<std::string> arguments;
+	size_t image_count;
+};
+
+std::string stripComments(const std::string &s)
+{
+	std::string result;
+	for(size_t i = 0;i<s.size();++i)
+	{
+		if(s.compare(i, 2, "//") == 0)
+		{
+			while(i<s.size() && s[i] != '\n')
+				++i;
+			result += '\n';
+		}
+		else if(s.compare(i, 2, "/*") == 0)
+		{
+			size_t end = s.find("*/", i+2);
+			i = end == std::string::npos ? s.size() : end+1;
+			result += ' ';
+		}
+		else
+		{
+			result += s[i];
+		}
+	}
+	return result;
+}
+
+std::vector<std::string> tokenize(const std::string &s)
+{
+	std::vector<std::string> tokens;
+	std::string current;
+	for(size_t i = 0;i<s.size();++i)
+	{
+		const char c = s[i];
+		if(std::isalnum(static_cast<unsigned char>(c)) || c == '_')
+		{
+			current += c;
+			continue;
+		}
+		if(!current.empty())
+			tokens.push_back(current);
+		current.clear();
+		if(c == '*')
+			tokens.push_back("*");
+	}
+	if(!current.empty())
+		tokens.push_back(current);
+	return tokens;
+}
+
+bool isQualifier(const std::string &t)
+{
+	static const char *qualifiers[] = {
+		"const", "volatile", "restrict", "__restrict", "private", "__private",
+		"read_only", "__read_only", "write_only", "__write_only", "read_write", "__read_write"
+	};
+	for(size_t i = 0;i<sizeof(qualifiers)/sizeof(qualifiers[0]);++i)
+		if(t == qualifiers[i])
+			return true;
+	return false;
+}
+
+std::string hostType(const std::string &type)
+{
+	static const char *builtin[] = {
+		"char", "uchar", "short", "ushort", "int", "uint", "long", "ulong", "float", "double"
+	};
+	std::string base = type;
+	while(!base.empty() && std::isdigit(static_cast<unsigned char>(base[base.size()-1])))
+		base.erase(base.size()-1);
+	for(size_t i = 0;i<sizeof(builtin)/sizeof(builtin[0]);++i)
+		if(base == builtin[i])
+			return "cl_" + type;
+	// user defined types are expected to have a host definition of the same name
+	return type;
+}
+
+std::string translateArgument(const std::string &declaration, size_t &image_count)
+{
+	std::vector<std::string> tokens = tokenize(declaration);
+	bool pointer = false, local = false;
+	std::vector<std::string> type;
+	for(size_t i = 0;i<tokens.size();++i)
+	{
+		const std::string &t = tokens[i];
+		if(t == "*")
+			pointer = true;
+		else if(t == "local" || t == "__local")
+			local = true;
+		else if(t == "global" || t == "__global" || t == "constant" || t == "__constant" || isQualifier(t))
+			continue;
+		else
+			type.push_back(t);
+	}
+	if(type.size() < 2)
+		throw std::runtime_error("cannot parse kernel argument '" + declaration + "'");
+	type.pop_back(); // argument name
+
+	std::string name;
+	if(type.size() == 2 && type[0] == "unsigned")
+		name = "u" + type[1];
+	else if(type.size() == 1)
+		name = type[0];
+	else
+		throw std::runtime_error("unsupported kernel argument type in '" + declaration + "'");
+
+	if(pointer)
+		return local ? "clp::Local<" + hostType(name) + ">" : hostType(name) + "*";
+
+	static const char *images[][2] = {
+		{"image1d_t", "Image1D"}, {"image1d_buffer_t", "Image1DBuffer"}, {"image2d_t", "Image2D"},
+		{"image2d_array_t", "Image2DArray"}, {"image3d_t", "Image3D"}
+	};
+	for(size_t i = 0;i<sizeof(images)/sizeof(images[0]);++i)
+	{
+		if(name == images[i][0])
+		{
+			std::ostringstream out;
+			out << "clp::" << images[i][1] << "<I" << image_count++ << ">";
+			return out.str();
+		}
+	}
+	if(name == "sampler_t")
+		return "clp::Sampler";
+	return hostType(name);
+}
+
+std::vector<KernelDecl> parseKernels(const std::string &source)
+{
+	std::vector<KernelDecl> kernels;
+	const std::string code = stripComments(source);
+	const std::regex declaration("\\b(?:__kernel|kernel)\\s+(?:__attribute__\\s*\\(\\(.*?\\)\\)\\s*)?void\\s+(\\w+)\\s*\\(([^)]*)\\)");
+	for(std::sregex_iterator i(code.begin(), code.end(), declaration), end;i!=end;++i)
+	{
+		KernelDecl kernel;
+		kernel.name = (*i)[1];
+		kernel.image_count = 0;
+		std::stringstream arguments((*i)[2]);
+		std::string argument;
+		while(std::getline(arguments, argument, ','))
+		{
+			if(argument.find_first_not_of(" \t\r\n") == std::string::npos || tokenize(argument) == std::vector<std::string>(1, "void"))
+				continue;
+			kernel.arguments.push_back(translateArgument(argument, kernel.image_count));
+		}
+		if(kernel.arguments.empty() || kernel.arguments.size() > max_arguments)
+			throw std::runtime_error("kernel " + kernel.name + ": clp::Kernel supports 1 to 8 arguments");
+		kernels.push_back(kernel);
+	}
+	return kernels;
+}
+
+std::string identifier(const std::string &path)
+{
+	size_t begin = path.find_last_of("/\\");
+	begin = begin == std::string::npos ? 0 : begin+1;
+	std::string stem = path.substr(begin, path.find('.', begin) - begin);
+	std::string result;
+	for(size_t i = 0;i<stem.size();++i)
+		result += std::isalnum(static_cast<unsigned char>(stem[i])) ? stem[i] : '_';
+	if(result.empty() || std::isdigit(static_cast<unsigned char>(result[0])))
+		result = "_" + result;
+	return result;
+}
+
+void writeHeader(std::ostream &out, const std::string &input, const std::string &ns, const std::string &source, const std::vector<KernelDecl> &kernels)
+{
+	std::string guard = "CLPGEN_" + ns + "_H";
+	for(size_t i = 0;i<guard.size();++i)
+		guard[i] = std::toupper(static_cast<unsigned char>(guard[i]));
+
+	out << "// Generated by clpgen from " << input << ", do not edit.\n";
+	out << "#ifndef " << guard << "\n#define " << guard << "\n\n";
+	out << "#include \"CLProgram.h\"\n\n";
+	out << "namespace " << ns << " {\n\n";
+	out << "inline const char* source()\n{\n\treturn R\"clpgen(" << source << ")clpgen\";\n}\n\n";
+	out << "class Module {\npublic:\n";
+	out << "\texplicit Module(const clp::Context &c, const std::string &options = \"\")\n";
+	out << "\t\t: program(c)\n\t{\n\t\tprogram.setSource(source());\n\t\tprogram.build(options);\n\t}\n";
+	for(size_t k = 0;k<kernels.size();++k)
+	{
+		const KernelDecl &kernel = kernels[k];
+		std::string signature = "void(";
+		for(size_t i = 0;i<kernel.arguments.size();++i)
+			signature += (i ? ", " : "") + kernel.arguments[i];
+		signature += ")";
+
+		out << "\n";
+		if(kernel.image_count)
+		{
+			out << "\t// I0.. are the host element types of the image arguments\n\ttemplate<";
+			for(size_t i = 0;i<kernel.image_count;++i)
+				out << (i ? ", " : "") << "class I" << i;
+			out << ">\n";
+		}
+		out << "\tclp::Kernel<" << signature << "> " << kernel.name << "()\n\t{\n";
+		out << "\t\treturn program.getKernel<" << signature << ">(\"" << kernel.name << "\");\n\t}\n";
+	}
+	out << "\n\tclp::Program& getProgram() { return program; }\n";
+	out << "private:\n\tclp::Program program;\n};\n\n";
+	out << "}\n\n#endif\n";
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+	if(argc < 3 || argc > 4)
+	{
+		std::cerr << "usage: " << argv[0] << " input.cl output.h [namespace]" << std::endl;
+		return 1;
+	}
+	try
+	{
+		std::ifstream in(argv[1]);
+		if(!in)
+			throw std::runtime_error(std::string("cannot open ") + argv[1]);
+		std::stringstream buffer;
+		buffer << in.rdbuf();
+		const std::string source = buffer.str();
+		if(source.find(")clpgen\"") != std::string::npos)
+			throw std::runtime_error("source contains the raw string delimiter");
+
+		const std::vector<KernelDecl> kernels = parseKernels(source);
+		const std::string ns = argc == 4 ? argv[3] : identifier(argv[1]);
+
+		std::ofstream out(argv[2]);
+		if(!out)
+			throw std::runtime_error(std::string("cannot write ") + argv[2]);
+		writeHeader(out, argv[1], ns, source, kernels);
+	}
+	catch(const std::exception &e)
+	{
+		std::cerr << argv[0] << ": " << e.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}